@@ -0,0 +1,222 @@
+/**
+ * @file FieldAccessBenchmark.cpp
+ *
+ * This module holds a benchmark which measures how long it takes a
+ * script to read or write one field of a component, and how much
+ * garbage doing so makes.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Components.hpp"
+#include "ScriptHost.hpp"
+
+#include <chrono>
+#include <lua.h>
+#include <memory>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+
+namespace {
+
+    /**
+     * This is the number of entities whose components are accessed.
+     */
+    constexpr int NUM_ENTITIES = 1000;
+
+    /**
+     * This is the number of times each benchmark accesses a field of
+     * every entity's component.
+     */
+    constexpr int NUM_PASSES = 1000;
+
+    /**
+     * These are the names of the benchmarks defined in the script,
+     * in the order in which to run them.
+     */
+    const char* const BENCHMARKS[] = {
+        "loop only",
+        "read position.x",
+        "write position.x",
+        "read tile.z",
+        "write tile.z",
+    };
+
+    /**
+     * This is the script which sets up the entities and runs the
+     * benchmarks.  The components are looked up once, before
+     * measuring, so that only accessing their fields is measured.
+     * The "loop only" benchmark measures the cost of the loop itself,
+     * for comparison.  Component types are given by name, so that the
+     * script can be run against older versions of Components.
+     */
+    const std::string SCRIPT = R"lua(
+local positions = {}
+local tiles = {}
+
+function Setup(components, count)
+    for i = 1, count do
+        local id = components:CreateEntity()
+        local position = components:CreateComponentOfType("position", id)
+        local tile = components:CreateComponentOfType("tile", id)
+        position.x = i
+        position.y = 0
+        tile.z = 1
+        positions[i] = position
+        tiles[i] = tile
+    end
+end
+
+local benchmarks = {
+    ["loop only"] = function(passes)
+        local sum = 0
+        for pass = 1, passes do
+            for i = 1, #positions do
+                local position = positions[i]
+                sum = sum + i
+            end
+        end
+        return sum
+    end,
+    ["read position.x"] = function(passes)
+        local sum = 0
+        for pass = 1, passes do
+            for i = 1, #positions do
+                local position = positions[i]
+                sum = sum + position.x
+            end
+        end
+        return sum
+    end,
+    ["write position.x"] = function(passes)
+        for pass = 1, passes do
+            for i = 1, #positions do
+                local position = positions[i]
+                position.x = pass
+            end
+        end
+    end,
+    ["read tile.z"] = function(passes)
+        local sum = 0
+        for pass = 1, passes do
+            for i = 1, #tiles do
+                local tile = tiles[i]
+                sum = sum + tile.z
+            end
+        end
+        return sum
+    end,
+    ["write tile.z"] = function(passes)
+        for pass = 1, passes do
+            for i = 1, #tiles do
+                local tile = tiles[i]
+                tile.z = pass
+            end
+        end
+    end,
+}
+
+function Prepare()
+    collectgarbage("collect")
+    collectgarbage("stop")
+    garbageBefore = collectgarbage("count")
+end
+
+function Run(name, passes)
+    benchmarks[name](passes)
+end
+
+function Finish()
+    garbageKilobytes = collectgarbage("count") - garbageBefore
+    collectgarbage("restart")
+end
+)lua";
+
+    /**
+     * Call the given function of the script, reporting any error.
+     *
+     * @param[in] scriptHost
+     *     This is the host of the script.
+     *
+     * @param[in] luaFunctionName
+     *     This is the name of the function to call.  Any arguments for
+     *     it must already be pushed onto the Lua stack.
+     *
+     * @return
+     *     An indication of whether or not the function ran without
+     *     error is returned.
+     */
+    bool Call(ScriptHost& scriptHost, const std::string& luaFunctionName) {
+        const auto errorMessage = scriptHost.Call(luaFunctionName);
+        if (!errorMessage.empty()) {
+            fprintf(
+                stderr,
+                "Error calling %s: %s\n",
+                luaFunctionName.c_str(),
+                errorMessage.c_str()
+            );
+            return false;
+        }
+        return true;
+    }
+
+}
+
+/**
+ * This function is the entrypoint of the program.
+ *
+ * @param[in] argc
+ *     This is the number of command-line arguments given to the program.
+ *
+ * @param[in] argv
+ *     This is the array of command-line arguments given to the program.
+ */
+int main(int argc, char* argv[]) {
+    Components components;
+    ScriptHost scriptHost;
+    components.SetDiagnosticsSender(
+        std::make_shared< SystemAbstractions::DiagnosticsSender >("FieldAccessBenchmark")
+    );
+    const auto lua = scriptHost.GetLua();
+    components.BuildComponentTypeMap(lua);
+    const auto errorMessage = scriptHost.LoadScript("benchmark", SCRIPT);
+    if (!errorMessage.empty()) {
+        fprintf(stderr, "Error loading benchmark: %s\n", errorMessage.c_str());
+        return EXIT_FAILURE;
+    }
+    components.PushLua(lua);
+    lua_pushinteger(lua, NUM_ENTITIES);
+    if (!Call(scriptHost, "Setup")) {
+        return EXIT_FAILURE;
+    }
+    const auto numAccesses = (double)NUM_ENTITIES * NUM_PASSES;
+    printf("%-20s %12s %16s\n", "benchmark", "ns/access", "bytes/access");
+    for (const auto benchmark: BENCHMARKS) {
+        if (!Call(scriptHost, "Prepare")) {
+            return EXIT_FAILURE;
+        }
+        lua_pushstring(lua, benchmark);
+        lua_pushinteger(lua, NUM_PASSES);
+        const auto start = std::chrono::steady_clock::now();
+        if (!Call(scriptHost, "Run")) {
+            return EXIT_FAILURE;
+        }
+        const auto finish = std::chrono::steady_clock::now();
+        if (!Call(scriptHost, "Finish")) {
+            return EXIT_FAILURE;
+        }
+        lua_getglobal(lua, "garbageKilobytes");
+        const auto garbageKilobytes = (double)lua_tonumber(lua, -1);
+        lua_pop(lua, 1);
+        printf(
+            "%-20s %12.1f %16.2f\n",
+            benchmark,
+            std::chrono::duration< double, std::nano >(finish - start).count() / numAccesses,
+            garbageKilobytes * 1024.0 / numAccesses
+        );
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file InputMessageBenchmark.cpp
+ *
+ * This module holds a benchmark which compares how long it takes to
+ * decode a message sent by a client with InputMessage against how long
+ * it takes with the general JSON parser, used the way the game used it
+ * before InputMessage.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "InputMessage.hpp"
+
+#include <chrono>
+#include <functional>
+#include <Json/Value.hpp>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+namespace {
+
+    /**
+     * This is the number of times to decode each message.
+     */
+    constexpr size_t NUM_DECODES = 1000000;
+
+    /**
+     * These are the messages to decode.  The first ones are what the
+     * client sends as keys are pressed and released.  The last one
+     * has an escape in it, so InputMessage hands it to the general
+     * JSON parser.
+     */
+    const std::string MESSAGES[] = {
+        R"json({"type":"move","key":"ArrowUp"})json",
+        R"json({"type":"move","key":""})json",
+        R"json({"type":"fire","key":"w"})json",
+        R"json({"type":"potion"})json",
+        R"json({"type":"resync"})json",
+        R"json({"type":"move","key":"\u0041rrowUp"})json",
+    };
+
+    /**
+     * Decode the given message with the general JSON parser, the way
+     * the game did before InputMessage.
+     *
+     * @param[in] encoding
+     *     This is the text of the message.
+     *
+     * @return
+     *     The decoded message is returned.
+     */
+    InputMessage DecodeWithJsonValue(const std::string& encoding) {
+        InputMessage message;
+        const auto json = Json::Value::FromEncoding(encoding);
+        if (json["type"] == "resync") {
+            message.type = InputMessage::Type::Resync;
+        } else if (json["type"] == "fire") {
+            message.type = InputMessage::Type::Fire;
+        } else if (json["type"] == "move") {
+            message.type = InputMessage::Type::Move;
+        } else if (json["type"] == "potion") {
+            message.type = InputMessage::Type::Potion;
+        }
+        if (
+            (message.type == InputMessage::Type::Fire)
+            || (message.type == InputMessage::Type::Move)
+        ) {
+            const auto keyString = (std::string)json["key"];
+            if (!keyString.empty()) {
+                message.key = keyString[0];
+            }
+        }
+        return message;
+    }
+
+    /**
+     * Decode the given message many times with the given decoder.
+     *
+     * @param[in] decode
+     *     This is the decoder to use.
+     *
+     * @param[in] encoding
+     *     This is the text of the message.
+     *
+     * @param[out] checksum
+     *     This is where to add up what was decoded, so that the
+     *     decoding can't be left out by the compiler.
+     *
+     * @return
+     *     The average time taken to decode the message, in
+     *     nanoseconds, is returned.
+     */
+    double TimeDecoder(
+        const std::function< InputMessage(const std::string&) >& decode,
+        const std::string& encoding,
+        size_t& checksum
+    ) {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < NUM_DECODES; ++i) {
+            const auto message = decode(encoding);
+            checksum += (size_t)message.type + (size_t)message.key;
+        }
+        const auto finish = std::chrono::steady_clock::now();
+        return std::chrono::duration< double, std::nano >(finish - start).count() / NUM_DECODES;
+    }
+
+}
+
+/**
+ * This function is the entrypoint of the program.
+ *
+ * @param[in] argc
+ *     This is the number of command-line arguments given to the program.
+ *
+ * @param[in] argv
+ *     This is the array of command-line arguments given to the program.
+ */
+int main(int argc, char* argv[]) {
+    size_t checksum = 0;
+    printf("%-40s %16s %16s\n", "message", "Json ns", "InputMessage ns");
+    for (const auto& encoding: MESSAGES) {
+        const auto general = DecodeWithJsonValue(encoding);
+        const auto specialized = InputMessage::FromEncoding(encoding);
+        if (
+            (general.type != specialized.type)
+            || (general.key != specialized.key)
+        ) {
+            fprintf(stderr, "Decoders disagree on %s\n", encoding.c_str());
+            return EXIT_FAILURE;
+        }
+        const auto generalTime = TimeDecoder(DecodeWithJsonValue, encoding, checksum);
+        const auto specializedTime = TimeDecoder(InputMessage::FromEncoding, encoding, checksum);
+        printf("%-40s %16.1f %16.1f\n", encoding.c_str(), generalTime, specializedTime);
+    }
+    printf("(checksum %zu)\n", checksum);
+    return EXIT_SUCCESS;
+}
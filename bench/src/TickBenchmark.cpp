@@ -0,0 +1,284 @@
+/**
+ * @file TickBenchmark.cpp
+ *
+ * This module holds a benchmark which measures how long one game tick
+ * takes as the number of entities in the game grows.  A tick here is
+ * what the game's worker does each tick before rendering: run the
+ * systems in systems.lua, then reset change tracking.
+ *
+ * Usage: TickBenchmark [path to systems.lua]
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "AtomTable.hpp"
+#include "Components.hpp"
+#include "Components/Hero.hpp"
+#include "Components/Reward.hpp"
+#include "Components/Tile.hpp"
+#include "ScriptHost.hpp"
+
+#include <chrono>
+#include <lua.h>
+#include <math.h>
+#include <memory>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <SystemAbstractions/File.hpp>
+
+namespace {
+
+    /**
+     * These are the numbers of monsters for which to measure a tick.
+     */
+    constexpr size_t MONSTER_COUNTS[] = {200, 1000, 5000, 20000, 50000};
+
+    /**
+     * This is how many ticks to run before measuring, so that every
+     * system has run at least once and the Lua garbage collector has
+     * settled.
+     */
+    constexpr size_t WARMUP_TICKS = 10;
+
+    /**
+     * This is how many ticks to measure for each number of monsters.
+     * The monsters start far enough from the hero that none of them
+     * reaches it in this many ticks, so none is killed and the number
+     * of entities stays the same throughout.
+     */
+    constexpr size_t MEASURED_TICKS = 50;
+
+    /**
+     * This is how far, in each direction, the monsters start from
+     * the hero.
+     */
+    constexpr int MONSTER_DISTANCE = 100;
+
+    /**
+     * Read the entire contents of the given file into a string.
+     *
+     * @param[in] file
+     *     This is the file to read.
+     *
+     * @return
+     *     The contents of the file is returned.
+     */
+    std::string ReadFile(SystemAbstractions::File& file) {
+        if (!file.OpenReadOnly()) {
+            return "";
+        }
+        SystemAbstractions::IFile::Buffer buffer(file.GetSize());
+        const auto amountRead = file.Read(buffer);
+        file.Close();
+        if (amountRead != buffer.size()) {
+            return "";
+        }
+        return std::string(
+            buffer.begin(),
+            buffer.end()
+        );
+    }
+
+    /**
+     * This holds everything one game needs in order to tick, without
+     * the networking.
+     */
+    struct World {
+        /**
+         * This is used to intern the names of tiles.
+         */
+        std::shared_ptr< AtomTable > atoms = std::make_shared< AtomTable >();
+
+        /**
+         * This holds all the entities and their components.
+         */
+        Components components;
+
+        /**
+         * This runs the systems.
+         */
+        ScriptHost scriptHost;
+
+        /**
+         * This counts the ticks run so far.
+         */
+        size_t tick = 0;
+
+        /**
+         * Add a hero at the given position, made the same way the
+         * game makes its player.
+         *
+         * @param[in] x
+         *     This is the column at which to put the hero.
+         *
+         * @param[in] y
+         *     This is the row at which to put the hero.
+         */
+        void AddPlayer(int x, int y) {
+            const auto id = components.CreateEntity();
+            (void)components.CreateComponentOfType(Components::Type::Collider, id);
+            (void)components.CreateComponentOfType(Components::Type::Health, id);
+            const auto hero = (Hero*)components.CreateComponentOfType(Components::Type::Hero, id);
+            (void)components.CreateComponentOfType(Components::Type::Position, id);
+            const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
+            components.SetColliderMask(id, 1);
+            tile->name = atoms->Intern("hero");
+            tile->z = 2;
+            components.SetPosition(id, x, y);
+            components.SetHealth(id, 100);
+            hero->score = 0;
+            hero->potions = 0;
+        }
+
+        /**
+         * Add a monster at the given position, made the same way the
+         * game makes its monsters.
+         *
+         * @param[in] x
+         *     This is the column at which to put the monster.
+         *
+         * @param[in] y
+         *     This is the row at which to put the monster.
+         */
+        void AddMonster(int x, int y) {
+            const auto id = components.CreateEntity();
+            (void)components.CreateComponentOfType(Components::Type::Collider, id);
+            (void)components.CreateComponentOfType(Components::Type::Health, id);
+            (void)components.CreateComponentOfType(Components::Type::Monster, id);
+            (void)components.CreateComponentOfType(Components::Type::Position, id);
+            const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
+            const auto reward = (Reward*)components.CreateComponentOfType(Components::Type::Reward, id);
+            components.SetColliderMask(id, 2);
+            tile->name = atoms->Intern("monster");
+            tile->z = 2;
+            components.SetPosition(id, x, y);
+            components.SetHealth(id, 1);
+            reward->score = 10;
+        }
+
+        /**
+         * Run one tick of the game, the way the game's worker does,
+         * leaving out rendering.
+         *
+         * @return
+         *     An indication of whether or not the systems ran without
+         *     error is returned.
+         */
+        bool Tick() {
+            ++tick;
+            const auto lua = scriptHost.GetLua();
+            components.PushLua(lua);
+            lua_pushnil(lua);
+            lua_pushinteger(lua, (lua_Integer)tick);
+            const auto errorMessage = scriptHost.Call("update");
+            if (!errorMessage.empty()) {
+                fprintf(stderr, "Error updating systems: %s\n", errorMessage.c_str());
+                return false;
+            }
+            components.ResetChanged();
+            return true;
+        }
+    };
+
+    /**
+     * Set up a game with one hero and the given number of monsters,
+     * tick it until it's warmed up, and then measure its ticks.
+     *
+     * @param[in] systemsLua
+     *     This is the text of the systems to run each tick.
+     *
+     * @param[in] numMonsters
+     *     This is the number of monsters to put in the game.
+     *
+     * @param[out] secondsPerTick
+     *     This is where to store the average time taken by a
+     *     measured tick.
+     *
+     * @return
+     *     An indication of whether or not the benchmark ran without
+     *     error is returned.
+     */
+    bool MeasureTicks(
+        const std::string& systemsLua,
+        size_t numMonsters,
+        double& secondsPerTick
+    ) {
+        World world;
+        world.components.SetDiagnosticsSender(
+            std::make_shared< SystemAbstractions::DiagnosticsSender >("TickBenchmark")
+        );
+        world.components.SetAtomTable(world.atoms);
+        world.components.BuildComponentTypeMap(world.scriptHost.GetLua());
+        const auto errorMessage = world.scriptHost.LoadScript("systems", systemsLua);
+        if (!errorMessage.empty()) {
+            fprintf(stderr, "Error loading systems: %s\n", errorMessage.c_str());
+            return false;
+        }
+        world.AddPlayer(0, 0);
+        const auto side = (size_t)ceil(sqrt((double)numMonsters));
+        for (size_t i = 0; i < numMonsters; ++i) {
+            world.AddMonster(
+                MONSTER_DISTANCE + (int)(i % side),
+                MONSTER_DISTANCE + (int)(i / side)
+            );
+        }
+        for (size_t i = 0; i < WARMUP_TICKS; ++i) {
+            if (!world.Tick()) {
+                return false;
+            }
+        }
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < MEASURED_TICKS; ++i) {
+            if (!world.Tick()) {
+                return false;
+            }
+        }
+        const auto finish = std::chrono::steady_clock::now();
+        secondsPerTick = (
+            std::chrono::duration< double >(finish - start).count()
+            / MEASURED_TICKS
+        );
+        return true;
+    }
+
+}
+
+/**
+ * This function is the entrypoint of the program.
+ *
+ * @param[in] argc
+ *     This is the number of command-line arguments given to the program.
+ *
+ * @param[in] argv
+ *     This is the array of command-line arguments given to the program.
+ */
+int main(int argc, char* argv[]) {
+    SystemAbstractions::File systemsLuaFile(
+        (argc > 1)
+        ? std::string(argv[1])
+        : SystemAbstractions::File::GetExeParentDirectory() + "/systems.lua"
+    );
+    const auto systemsLua = ReadFile(systemsLuaFile);
+    if (systemsLua.empty()) {
+        fprintf(stderr, "Unable to load systems.lua\n");
+        return EXIT_FAILURE;
+    }
+    printf("%10s %12s %14s\n", "entities", "ms/tick", "us/entity");
+    for (const auto numMonsters: MONSTER_COUNTS) {
+        double secondsPerTick;
+        if (!MeasureTicks(systemsLua, numMonsters, secondsPerTick)) {
+            return EXIT_FAILURE;
+        }
+        const auto numEntities = numMonsters + 1;
+        printf(
+            "%10zu %12.3f %14.3f\n",
+            numEntities,
+            secondsPerTick * 1e3,
+            secondsPerTick * 1e6 / numEntities
+        );
+    }
+    return EXIT_SUCCESS;
+}
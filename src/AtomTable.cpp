@@ -0,0 +1,64 @@
+/**
+ * @file AtomTable.cpp
+ *
+ * This module contains the implementations of the AtomTable class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "AtomTable.hpp"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * This contains the private properties of an AtomTable class instance.
+ */
+struct AtomTable::Impl {
+    /**
+     * This is used to synchronize access to the table.
+     */
+    std::mutex mutex;
+
+    /**
+     * These are the names in the table, indexed by atom.  A deque is
+     * used so that adding names never moves the names already there.
+     */
+    std::deque< std::string > names = {""};
+
+    /**
+     * This maps each name in the table to its atom.
+     */
+    std::unordered_map< std::string, int > atoms = {{"", 0}};
+};
+
+AtomTable::~AtomTable() noexcept = default;
+
+AtomTable::AtomTable()
+    : impl_(new Impl())
+{
+}
+
+int AtomTable::Intern(const std::string& name) {
+    std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+    const auto atomsEntry = impl_->atoms.find(name);
+    if (atomsEntry != impl_->atoms.end()) {
+        return atomsEntry->second;
+    }
+    const auto atom = (int)impl_->names.size();
+    impl_->names.push_back(name);
+    impl_->atoms[name] = atom;
+    return atom;
+}
+
+const std::string& AtomTable::GetName(int atom) {
+    std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+    if (
+        (atom < 0)
+        || ((size_t)atom >= impl_->names.size())
+    ) {
+        return impl_->names[0];
+    }
+    return impl_->names[atom];
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+/**
+ * @file AtomTable.hpp
+ *
+ * This module declares the AtomTable class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <string>
+
+/**
+ * This holds the names, such as sprite and texture names, which are
+ * shared by all games on the server, and assigns each one a small
+ * integer, called an atom, so that components can store and compare
+ * atoms rather than strings.  It may be used from any thread.
+ */
+class AtomTable {
+    // Lifecycle Methods
+public:
+    ~AtomTable() noexcept;
+    AtomTable(const AtomTable&) = delete;
+    AtomTable(AtomTable&&) noexcept = delete;
+    AtomTable& operator=(const AtomTable&) = delete;
+    AtomTable& operator=(AtomTable&&) noexcept = delete;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     */
+    AtomTable();
+
+    /**
+     * Return the atom for the given name, adding the name to the table
+     * if it isn't already there.
+     *
+     * @param[in] name
+     *     This is the name for which to return the atom.
+     *
+     * @return
+     *     The atom for the given name is returned.  The empty name
+     *     is always atom zero.
+     */
+    int Intern(const std::string& name);
+
+    /**
+     * Return the name of the given atom.
+     *
+     * @param[in] atom
+     *     This is the atom whose name should be returned.
+     *
+     * @return
+     *     The name of the given atom is returned, or the empty name
+     *     if the atom is not in the table.  The name stays valid for
+     *     as long as the table exists.
+     */
+    const std::string& GetName(int atom);
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
@@ -1,5 +1,16 @@
 #pragma once
 
+#include <stdint.h>
+
+/**
+ * This identifies an entity.  The low 32 bits hold the index of the
+ * entity, which is recycled once the entity is gone, and the high 32 bits
+ * hold the generation of that index, which changes every time the index
+ * is recycled, so that an ID kept after its entity is gone never matches
+ * a newer entity.  Zero never identifies an entity.
+ */
+typedef uint64_t EntityId;
+
 struct Component {
-    int entityId = 0;
+    EntityId entityId = 0;
 };
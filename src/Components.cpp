@@ -1,46 +1,547 @@
+#include "AtomTable.hpp"
 #include "Components.hpp"
+#include "PagedVector.hpp"
 
 #include <algorithm>
 #include <functional>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
+namespace {
+
+    /**
+     * The address of this is the key of the table in the Lua registry
+     * which caches atoms.  The table maps each atom to its name as a
+     * Lua string, and each such name back to its atom.
+     */
+    const char atomCacheKey = 0;
+
+    /**
+     * Return the index part of the given entity ID.
+     *
+     * @param[in] entityId
+     *     This is the entity ID to break down.
+     *
+     * @return
+     *     The index part of the given entity ID is returned.
+     */
+    uint32_t GetEntityIndex(EntityId entityId) {
+        return (uint32_t)entityId;
+    }
+
+    /**
+     * Return the generation part of the given entity ID.
+     *
+     * @param[in] entityId
+     *     This is the entity ID to break down.
+     *
+     * @return
+     *     The generation part of the given entity ID is returned.
+     */
+    uint32_t GetEntityGeneration(EntityId entityId) {
+        return (uint32_t)(entityId >> 32);
+    }
+
+    /**
+     * Combine the given entity index and generation into an entity ID.
+     *
+     * @param[in] index
+     *     This is the index of the entity.
+     *
+     * @param[in] generation
+     *     This is the generation of the entity index.
+     *
+     * @return
+     *     The entity ID is returned.
+     */
+    EntityId MakeEntityId(uint32_t index, uint32_t generation) {
+        return ((EntityId)generation << 32) | (EntityId)index;
+    }
+
+    /**
+     * Compute the squared distance from the given point to each of the
+     * given points.  This is kept free of branches and calls so that
+     * the compiler can vectorize it.
+     *
+     * @param[in] xs
+     *     These are the horizontal coordinates of the points.
+     *
+     * @param[in] ys
+     *     These are the vertical coordinates of the points.
+     *
+     * @param[in] n
+     *     This is the number of points.
+     *
+     * @param[in] x
+     *     This is the horizontal coordinate of the point from which
+     *     to measure.
+     *
+     * @param[in] y
+     *     This is the vertical coordinate of the point from which
+     *     to measure.
+     *
+     * @param[out] squaredDistances
+     *     This is where to store the squared distances.
+     */
+    void ComputeSquaredDistances(
+        const int* xs,
+        const int* ys,
+        size_t n,
+        int x,
+        int y,
+        int64_t* squaredDistances
+    ) {
+        for (size_t i = 0; i < n; ++i) {
+            const auto dx = (int64_t)xs[i] - x;
+            const auto dy = (int64_t)ys[i] - y;
+            squaredDistances[i] = dx * dx + dy * dy;
+        }
+    }
+
+    /**
+     * Combine the given cell coordinates into a key for the spatial index.
+     *
+     * @param[in] x
+     *     This is the horizontal coordinate of the cell.
+     *
+     * @param[in] y
+     *     This is the vertical coordinate of the cell.
+     *
+     * @return
+     *     The key for the cell is returned.
+     */
+    uint64_t MakeCellKey(int x, int y) {
+        return ((uint64_t)(uint32_t)x << 32) | (uint64_t)(uint32_t)y;
+    }
+
+}
+
+struct ComponentType;
+
+/**
+ * This is where an iteration over the components of one type has got to.
+ * Removing a component moves the last component of its type into its
+ * slot, which may be a slot the iteration has already visited, so an
+ * iteration also checks the moves made since its last step, and visits
+ * any component moved from the part not yet visited into the part
+ * already visited before carrying on in order.
+ */
+struct IterationCursor {
+    /**
+     * This is the Lua index of the next component in order for the
+     * iteration to visit.
+     */
+    size_t next = 1;
+
+    /**
+     * This is the position, in the move log of the type, of the next
+     * move for the iteration to check.
+     */
+    size_t nextMove = 0;
+
+    /**
+     * Return the Lua index of the next component for the iteration to
+     * visit, and step past it.
+     *
+     * @param[in] componentType
+     *     This is the type of components being iterated.
+     *
+     * @return
+     *     The Lua index of the next component to visit is returned,
+     *     or zero if every component has been visited.
+     */
+    size_t Advance(const ComponentType& componentType);
+};
+
+/**
+ * This is the userdata by which Lua refers to a component.
+ */
+struct ScriptComponent {
+    /**
+     * This is the Lua index of the component when the script component
+     * was last pointed at it.
+     */
+    size_t index;
+
+    /**
+     * This is the ID of the entity which has the component.
+     */
+    EntityId entityId;
+
+    /**
+     * If the script component was yielded by a step of iterating over
+     * a collection, this is where the iteration has got to.
+     */
+    IterationCursor cursor;
+};
+
+/**
+ * This holds copies of some of the int fields of all the components of
+ * one type, one contiguous column per field, in the same order as the
+ * components themselves.
+ */
+struct ComponentColumnStorage {
+    /**
+     * This holds the ID of the entity of each component.
+     */
+    std::vector< EntityId > entityIds;
+
+    /**
+     * These are the columns, one per field, in the order in which the
+     * fields were given when the component type was made.
+     */
+    std::vector< std::vector< int > > fields;
+};
+
+/**
+ * This records which components of one type have changed since the
+ * changes were last reset.
+ */
+struct ChangeSet {
+    /**
+     * This holds, for each entity index, the ID of the entity whose
+     * component is recorded as changed, or zero if none is.  Keeping
+     * the whole ID means a change recorded for an entity never counts
+     * for a later entity which recycles its index.
+     */
+    std::vector< EntityId > marks;
+
+    /**
+     * These are the IDs of the entities whose components have changed,
+     * in the order in which they first changed.
+     */
+    std::vector< EntityId > entityIds;
+
+    /**
+     * Record that the component of the given entity has changed.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity whose component has changed.
+     */
+    void Mark(EntityId entityId) {
+        const auto entityIndex = GetEntityIndex(entityId);
+        if (entityIndex >= marks.size()) {
+            marks.resize((size_t)entityIndex + 1);
+        }
+        if (marks[entityIndex] != entityId) {
+            marks[entityIndex] = entityId;
+            entityIds.push_back(entityId);
+        }
+    }
+
+    /**
+     * Forget all recorded changes.
+     */
+    void Reset() {
+        for (const auto entityId: entityIds) {
+            marks[GetEntityIndex(entityId)] = 0;
+        }
+        entityIds.clear();
+    }
+};
+
+/**
+ * This records, in order, the components of one type which removals
+ * have moved from the end of the type into the slot of the component
+ * removed, so that iterations under way can account for them.  The log
+ * is reset once per tick, since no iteration outlasts a tick.
+ */
+struct MoveLog {
+    /**
+     * This describes the moving of one component.
+     */
+    struct Move {
+        EntityId entityId;
+        size_t from;
+        size_t to;
+    };
+
+    /**
+     * These are the moves recorded since the log was last reset.
+     */
+    std::vector< Move > moves;
+
+    /**
+     * This is the number of moves forgotten when the log was reset,
+     * which is the position in the log of the first move kept.
+     */
+    size_t numForgotten = 0;
+
+    /**
+     * Return the position in the log of the next move to be recorded.
+     *
+     * @return
+     *     The position in the log of the next move to be recorded
+     *     is returned.
+     */
+    size_t End() const {
+        return numForgotten + moves.size();
+    }
+
+    /**
+     * Forget all recorded moves.
+     */
+    void Reset() {
+        numForgotten += moves.size();
+        moves.clear();
+    }
+};
+
 struct ComponentType {
     std::function< Components::ComponentList() > list;
-    std::function< Component*(int entityId) > create;
-    std::function< void(int entityId) > destroy;
-    std::function< void(int entityId) > kill;
-    std::function< Component*(int entityId) > get;
-    std::function< size_t(int entityId) > getLuaIndex;
+    std::function< Components::ComponentColumns() > columns;
+    std::function< bool() > columnsMatch;
+    std::shared_ptr< ChangeSet > changes;
+    std::shared_ptr< MoveLog > moves;
+    std::function< void(EntityId entityId) > markChanged;
+    std::function< size_t() > count;
+    std::function< EntityId(size_t index) > getEntityId;
+    std::function< Component*(EntityId entityId) > create;
+    std::function< void(EntityId entityId) > destroy;
+    std::function< void(EntityId entityId) > kill;
+    std::function< Component*(EntityId entityId) > get;
+    std::function< size_t(EntityId entityId) > getLuaIndex;
     std::function< void(lua_State* lua, size_t index) > push;
+
+    /**
+     * This keeps alive the ComponentStorage of the type, to which the
+     * field metamethods of its components point.
+     */
+    std::shared_ptr< void > storage;
+};
+
+size_t IterationCursor::Advance(const ComponentType& componentType) {
+    // The cursor only moves on in order once every move recorded so far
+    // has been checked, so every move still to be checked was made while
+    // the cursor was where it is now.
+    const auto& log = *componentType.moves;
+    while (nextMove < log.End()) {
+        const auto& move = log.moves[nextMove++ - log.numForgotten];
+        if (
+            (move.from >= next)
+            && (move.to < next)
+        ) {
+            const auto index = componentType.getLuaIndex(move.entityId);
+            if (
+                (index != 0)
+                && (index < next)
+            ) {
+                return index;
+            }
+        }
+    }
+    if (next > componentType.count()) {
+        return 0;
+    }
+    return next++;
+}
+
+/**
+ * This is the state of a Lua iterator returned by components:Query.
+ */
+struct QueryState {
+    /**
+     * This is the maximum number of component types a query may join.
+     */
+    static constexpr size_t maxTypes = 16;
+
+    /**
+     * These are the types of components joined by the query,
+     * in the order they were given.
+     */
+    const ComponentType* types[maxTypes];
+
+    /**
+     * This is the number of types of components joined by the query.
+     */
+    size_t numTypes = 0;
+
+    /**
+     * This is the position in types of the type which has the fewest
+     * components, which drives the iteration.
+     */
+    size_t driver = 0;
+
+    /**
+     * This is where the iteration over the driving components has got to.
+     */
+    IterationCursor cursor;
+
+    /**
+     * This indicates whether the iteration was started by Each, which
+     * reuses the same script components for every step, rather than by
+     * Query, which creates new ones for every step.
+     */
+    bool reuse = false;
 };
 
-template< typename T > using LuaPropertyMap = std::map< std::string, std::function< void(lua_State* lua, T* component) > >;
+/**
+ * This is the type of function which reads or writes one field of a
+ * component for Lua.  A reader pushes the value of the field.  A writer
+ * sets the field from the value at stack index 3.
+ */
+template< typename T > using LuaProperty = void (*)(lua_State* lua, T* component);
 
-struct Components::Impl {
-    int nextEntityId = 1;
-    std::map< Type, ComponentType > componentTypes;
-    std::set< std::string > collectionTypeNames;
-    std::map< std::string, Type > componentTypeNames;
-    std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender;
+template< typename T > using LuaPropertyMap = std::map< std::string, LuaProperty< T > >;
 
+/**
+ * This holds the components of one type and what's needed to find them
+ * by entity, keep their columns up to date, and record their changes.
+ *
+ * The Lua __index and __newindex metamethods of components are the plain
+ * C functions Index and NewIndex, rather than bindings, so that reading
+ * or writing a field makes no std::function calls.  They have these
+ * upvalues:
+ * 1. this storage, as a light userdata
+ * 2. the field table, which maps each field name to a light userdata
+ *    pointing to the property function which handles it
+ * 3. the component metatable
+ * 4. the string "entityId"
+ * 5. the Components::Impl which owns the storage, as a light userdata,
+ *    for the property functions which need it
+ */
+template< typename T > struct ComponentStorage {
     /**
-     * This is a Lua function registered as the __gc
-     * object metamethod of the "components" class.
+     * These are the components.
+     */
+    std::shared_ptr< PagedVector< T > > components;
+
+    /**
+     * This maps each entity index to the Lua index of its component,
+     * or zero if it has none.
+     */
+    std::shared_ptr< std::vector< size_t > > slots;
+
+    /**
+     * These hold copies of the columned fields of the components.
+     */
+    std::shared_ptr< ComponentColumnStorage > columns;
+
+    /**
+     * These are the fields of which copies are kept in columns.
+     */
+    std::vector< int T::* > columnFields;
+
+    /**
+     * This records which components have changed.
+     */
+    std::shared_ptr< ChangeSet > changes;
+
+    /**
+     * These are the property functions which read and write the fields
+     * of the components.  The field tables point into these.
+     */
+    std::shared_ptr< LuaPropertyMap< T > > indexers;
+    std::shared_ptr< LuaPropertyMap< T > > newIndexers;
+
+    /**
+     * Return the Lua index of the component of the given entity.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity whose component to find.
+     *
+     * @return
+     *     The Lua index of the component is returned, or zero if the
+     *     entity has no component of this type.
+     */
+    size_t GetLuaIndex(EntityId entityId) const {
+        const auto entityIndex = GetEntityIndex(entityId);
+        if (entityIndex >= slots->size()) {
+            return 0;
+        }
+        const auto index = (*slots)[entityIndex];
+        if (
+            (index == 0)
+            || ((*components)[index - 1].entityId != entityId)
+        ) {
+            return 0;
+        }
+        return index;
+    }
+
+    /**
+     * Copy the columned fields of the component at the given Lua index
+     * into the columns.
+     *
+     * @param[in] index
+     *     This is the Lua index of the component.
+     */
+    void UpdateColumns(size_t index) {
+        const auto& component = (*components)[index - 1];
+        columns->entityIds[index - 1] = component.entityId;
+        for (size_t i = 0; i < columnFields.size(); ++i) {
+            columns->fields[i][index - 1] = component.*columnFields[i];
+        }
+    }
+
+    /**
+     * Record that the component at the given Lua index has changed.
+     *
+     * @param[in] index
+     *     This is the Lua index of the component.
+     */
+    void MarkChanged(size_t index) {
+        changes->Mark((*components)[index - 1].entityId);
+        if (!columnFields.empty()) {
+            UpdateColumns(index);
+        }
+    }
+
+    /**
+     * Return the Lua index of the component to which the given script
+     * component refers.  A script component remembers the slot its
+     * component occupied when it was pushed.  If removals have since
+     * moved a different component into that slot, fall back to the
+     * entity index, so that the script component follows its own
+     * component, or resolves to nothing if that component was destroyed.
+     *
+     * @param[in] scriptComponent
+     *     This is the script component to resolve.
+     *
+     * @return
+     *     The Lua index of the component is returned, or zero if the
+     *     component no longer exists.
+     */
+    size_t Resolve(const ScriptComponent* scriptComponent) const {
+        const auto index = scriptComponent->index;
+        if (
+            (index > components->size())
+            || ((*components)[index - 1].entityId != scriptComponent->entityId)
+        ) {
+            return GetLuaIndex(scriptComponent->entityId);
+        }
+        return index;
+    }
+
+    /**
+     * Return the property function given in the field table for the
+     * field named at stack index 2, after checking that the value at
+     * stack index 1 is a component of this type.
      *
      * @param[in] lua
-     *     This points to the Lua interpreter instance.
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The property function for the field is returned, or nullptr
+     *     if the field has none.
      */
-    static int Finalizer(lua_State* lua) {
-        auto self = (std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        self->~shared_ptr< Impl >();
-        return 0;
+    static LuaProperty< T > CheckField(lua_State* lua) {
+        if (
+            !lua_getmetatable(lua, 1)
+            || !lua_rawequal(lua, -1, lua_upvalueindex(3))
+        ) {
+            (void)luaL_argerror(lua, 1, "not a component");
+        }
+        lua_pushvalue(lua, 2);
+        (void)lua_rawget(lua, lua_upvalueindex(2));
+        const auto property = (const LuaProperty< T >*)lua_touserdata(lua, -1);
+        return (property == nullptr) ? nullptr : *property;
     }
 
     /**
-     * This handles Lua index metamethod calls for
-     * the global components object.
+     * This is the __index metamethod of components of this type.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
@@ -51,46 +552,934 @@ struct Components::Impl {
      *     is returned.
      */
     static int Index(lua_State* lua) {
-        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        const std::string fieldName = luaL_checkstring(lua, 2);
-        const auto collectionTypeNamesEntry = self->collectionTypeNames.find(fieldName);
-        if (collectionTypeNamesEntry == self->collectionTypeNames.end()) {
-            luaL_getmetatable(lua, "components");
-            lua_insert(lua, 2);
-            lua_rawget(lua, 2);
+        const auto indexer = CheckField(lua);
+        const auto self = (const ScriptComponent*)lua_touserdata(lua, 1);
+        if (indexer == nullptr) {
+            if (lua_rawequal(lua, 2, lua_upvalueindex(4))) {
+                lua_pushinteger(lua, self->entityId);
+            } else {
+                lua_pushnil(lua);
+            }
+            return 1;
+        }
+        const auto storage = (ComponentStorage*)lua_touserdata(lua, lua_upvalueindex(1));
+        const auto index = storage->Resolve(self);
+        if (index == 0) {
+            lua_pushnil(lua);
         } else {
-            auto collectionWrapper = (std::shared_ptr< Impl >*)lua_newuserdata(lua, sizeof(std::shared_ptr< Impl >));
-            new (collectionWrapper) std::shared_ptr< Impl >();
-            *collectionWrapper = self;
-            luaL_setmetatable(lua, fieldName.c_str());
+            indexer(lua, &(*storage->components)[index - 1]);
+        }
+        return 1;
+    }
+
+    /**
+     * This is the __newindex metamethod of components of this type.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int NewIndex(lua_State* lua) {
+        const auto newIndexer = CheckField(lua);
+        const auto self = (const ScriptComponent*)lua_touserdata(lua, 1);
+        const auto storage = (ComponentStorage*)lua_touserdata(lua, lua_upvalueindex(1));
+        const auto index = storage->Resolve(self);
+        if (
+            (index != 0)
+            && (newIndexer != nullptr)
+        ) {
+            newIndexer(lua, &(*storage->components)[index - 1]);
+            storage->MarkChanged(index);
+        }
+        return 0;
+    }
+};
+
+struct Components::Impl {
+    /**
+     * This holds the current generation of each entity index.
+     * Index zero is never used, so that zero is never a valid entity ID.
+     */
+    std::vector< uint32_t > entityGenerations = {0};
+
+    /**
+     * This holds the number of components each entity index has.
+     */
+    std::vector< size_t > entityComponentCounts = {0};
+
+    /**
+     * This holds the entity indexes which are free to be recycled.
+     */
+    std::vector< uint32_t > freeEntityIndexes;
+
+    /**
+     * This is the spatial index of colliders.  It maps each cell, keyed
+     * by MakeCellKey, to the IDs of the entities which have both a collider
+     * and a position in that cell.
+     */
+    std::unordered_map< uint64_t, std::vector< EntityId > > colliderCells;
+
+    /**
+     * These are the dimensions of the static layer.
+     */
+    int staticLayerWidth = 0;
+    int staticLayerHeight = 0;
+
+    /**
+     * This holds the kind of tile in each cell of the static layer,
+     * row by row, as an index into staticTileKinds.
+     */
+    std::vector< uint8_t > staticTiles;
+
+    /**
+     * This holds the kinds of tiles which can be placed in the static
+     * layer.  Kind zero is the empty cell.
+     */
+    std::vector< StaticTileKind > staticTileKinds = {StaticTileKind()};
+
+    /**
+     * This holds the component types, indexed by type.  The index of each
+     * component type is also the token which identifies it in Lua.
+     */
+    std::vector< ComponentType > componentTypes;
+
+    std::set< std::string > collectionTypeNames;
+    std::map< std::string, Type > componentTypeNames;
+    std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender;
+
+    /**
+     * This holds the names of things, such as textures, which components
+     * refer to by atom.
+     */
+    std::shared_ptr< AtomTable > atoms = std::make_shared< AtomTable >();
+
+    /**
+     * These are reused by radius and nearest-entity queries to gather the
+     * entity ID and position of each component of the queried type which
+     * has a position, and the squared distance of that position from the
+     * point of the query.
+     */
+    std::vector< EntityId > measuredEntityIds;
+    std::vector< int > measuredXs;
+    std::vector< int > measuredYs;
+    std::vector< int64_t > squaredDistances;
+
+    /**
+     * Return the instance which owns the component whose field is being
+     * read or written.  This may only be called by property functions,
+     * which run inside the field metamethods of ComponentStorage.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The instance which owns the component is returned.
+     */
+    static Impl* GetFieldOwner(lua_State* lua) {
+        return (Impl*)lua_touserdata(lua, lua_upvalueindex(5));
+    }
+
+    /**
+     * Push onto the Lua stack the name of the given atom.  Names are
+     * cached as Lua strings, so that each name is only copied into
+     * the Lua interpreter once.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] atom
+     *     This is the atom whose name should be pushed.
+     */
+    void PushAtom(lua_State* lua, int atom) {
+        (void)lua_rawgetp(lua, LUA_REGISTRYINDEX, &atomCacheKey);
+        if (lua_rawgeti(lua, -1, atom) == LUA_TNIL) {
+            lua_pop(lua, 1);
+            const auto& name = atoms->GetName(atom);
+            lua_pushlstring(lua, name.data(), name.length());
+            lua_pushvalue(lua, -1);
+            lua_rawseti(lua, -3, atom);
+            lua_pushvalue(lua, -1);
+            lua_pushinteger(lua, (lua_Integer)atom);
+            lua_rawset(lua, -4);
+        }
+        lua_remove(lua, -2);
+    }
+
+    /**
+     * Return the atom for the name given as an argument of a Lua function.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] arg
+     *     This is the stack index of the argument.
+     *
+     * @return
+     *     The atom for the given name is returned.
+     */
+    int CheckAtom(lua_State* lua, int arg) {
+        (void)luaL_checkstring(lua, arg);
+        (void)lua_rawgetp(lua, LUA_REGISTRYINDEX, &atomCacheKey);
+        lua_pushvalue(lua, arg);
+        if (lua_rawget(lua, -2) == LUA_TNUMBER) {
+            const auto atom = (int)lua_tointeger(lua, -1);
+            lua_pop(lua, 2);
+            return atom;
+        }
+        lua_pop(lua, 1);
+        const auto atom = atoms->Intern(lua_tostring(lua, arg));
+        lua_pushvalue(lua, arg);
+        lua_pushinteger(lua, (lua_Integer)atom);
+        lua_rawset(lua, -3);
+        lua_pushvalue(lua, arg);
+        lua_rawseti(lua, -2, atom);
+        lua_pop(lua, 1);
+        return atom;
+    }
+
+    /**
+     * This is a Lua function registered as the __gc
+     * object metamethod of the "components" class.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     */
+    static int Finalizer(lua_State* lua) {
+        auto self = (std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        self->~shared_ptr< Impl >();
+        return 0;
+    }
+
+    /**
+     * This handles Lua index metamethod calls for
+     * the global components object.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int Index(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        (void)luaL_checkstring(lua, 2);
+
+        // Methods and type tokens are looked up first, since they are
+        // used most often and need no name to be built.
+        luaL_getmetatable(lua, "components");
+        lua_pushvalue(lua, 2);
+        lua_rawget(lua, -2);
+        if (!lua_isnil(lua, -1)) {
+            return 1;
+        }
+        const std::string fieldName = lua_tostring(lua, 2);
+        const auto collectionTypeNamesEntry = self->collectionTypeNames.find(fieldName);
+        if (collectionTypeNamesEntry == self->collectionTypeNames.end()) {
+            lua_pushnil(lua);
+        } else {
+            auto collectionWrapper = (std::shared_ptr< Impl >*)lua_newuserdata(lua, sizeof(std::shared_ptr< Impl >));
+            new (collectionWrapper) std::shared_ptr< Impl >();
+            *collectionWrapper = self;
+            luaL_setmetatable(lua, fieldName.c_str());
+        }
+        return 1;
+    }
+
+    /**
+     * This handles Lua newindex metamethod calls for
+     * the global components object.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int NewIndex(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const std::string fieldName = luaL_checkstring(lua, 2);
+        luaL_getmetatable(lua, "components");
+        lua_insert(lua, 2);
+        lua_rawset(lua, 2);
+        return 0;
+    }
+
+    /**
+     * This handles Lua tostring metamethod calls for
+     * the global components object.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int ToString(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        lua_pushstring(lua, "components()");
+        return 1;
+    }
+
+    EntityId CreateEntity() {
+        uint32_t index;
+        if (freeEntityIndexes.empty()) {
+            index = (uint32_t)entityGenerations.size();
+            entityGenerations.push_back(0);
+            entityComponentCounts.push_back(0);
+        } else {
+            index = freeEntityIndexes.back();
+            freeEntityIndexes.pop_back();
+        }
+        return MakeEntityId(index, entityGenerations[index]);
+    }
+
+    bool IsEntityAlive(EntityId entityId) {
+        const auto index = GetEntityIndex(entityId);
+        return (
+            (index != 0)
+            && (index < entityGenerations.size())
+            && (entityGenerations[index] == GetEntityGeneration(entityId))
+        );
+    }
+
+    /**
+     * Retire the given entity, advancing the generation of its index
+     * so that any IDs still held for it no longer match, and making the
+     * index available to be recycled.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity to retire.
+     */
+    void ReleaseEntity(EntityId entityId) {
+        const auto index = GetEntityIndex(entityId);
+        ++entityGenerations[index];
+        freeEntityIndexes.push_back(index);
+    }
+
+    /**
+     * Return the position of the given entity, if it has both a position
+     * and a collider, and so belongs in the spatial index of colliders.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity to look up.
+     *
+     * @return
+     *     The position of the entity is returned, or nullptr if the entity
+     *     doesn't belong in the spatial index of colliders.
+     */
+    Position* GetColliderPosition(EntityId entityId) {
+        if (componentTypes[(size_t)Type::Collider].get(entityId) == nullptr) {
+            return nullptr;
+        }
+        return (Position*)componentTypes[(size_t)Type::Position].get(entityId);
+    }
+
+    void AddColliderToCell(EntityId entityId, int x, int y) {
+        colliderCells[MakeCellKey(x, y)].push_back(entityId);
+    }
+
+    void RemoveColliderFromCell(EntityId entityId, int x, int y) {
+        const auto colliderCellsEntry = colliderCells.find(MakeCellKey(x, y));
+        if (colliderCellsEntry == colliderCells.end()) {
+            return;
+        }
+        auto& cell = colliderCellsEntry->second;
+        const auto cellEntry = std::find(cell.begin(), cell.end(), entityId);
+        if (cellEntry != cell.end()) {
+            *cellEntry = cell.back();
+            cell.pop_back();
+        }
+    }
+
+    /**
+     * Move the given position to the given coordinates, keeping the
+     * spatial index of colliders up to date.
+     *
+     * @param[in,out] position
+     *     This is the position to move.
+     *
+     * @param[in] x
+     *     This is the new horizontal coordinate of the position.
+     *
+     * @param[in] y
+     *     This is the new vertical coordinate of the position.
+     */
+    void MovePosition(Position& position, int x, int y) {
+        if (
+            ((x != position.x) || (y != position.y))
+            && (componentTypes[(size_t)Type::Collider].get(position.entityId) != nullptr)
+        ) {
+            RemoveColliderFromCell(position.entityId, position.x, position.y);
+            AddColliderToCell(position.entityId, x, y);
+        }
+        position.x = x;
+        position.y = y;
+    }
+
+    const StaticTileKind* GetStaticTile(int x, int y) {
+        if (
+            (x < 0)
+            || (y < 0)
+            || (x >= staticLayerWidth)
+            || (y >= staticLayerHeight)
+        ) {
+            return nullptr;
+        }
+        const auto kind = staticTiles[(size_t)y * staticLayerWidth + x];
+        if (kind == 0) {
+            return nullptr;
+        }
+        return &staticTileKinds[kind];
+    }
+
+    Collider* GetColliderAt(int x, int y) {
+        const auto colliderCellsEntry = colliderCells.find(MakeCellKey(x, y));
+        if (
+            (colliderCellsEntry == colliderCells.end())
+            || colliderCellsEntry->second.empty()
+        ) {
+            return nullptr;
+        }
+        return (Collider*)componentTypes[(size_t)Type::Collider].get(colliderCellsEntry->second.front());
+    }
+
+    bool IsObstacleInTheWay(int x, int y, int mask) {
+        const auto staticTile = GetStaticTile(x, y);
+        if (
+            (staticTile != nullptr)
+            && ((mask & staticTile->mask) != 0)
+        ) {
+            return true;
+        }
+        const auto colliderCellsEntry = colliderCells.find(MakeCellKey(x, y));
+        if (colliderCellsEntry == colliderCells.end()) {
+            return false;
+        }
+        const auto& colliderType = componentTypes[(size_t)Type::Collider];
+        for (const auto entityId: colliderCellsEntry->second) {
+            const auto collider = (Collider*)colliderType.get(entityId);
+            if ((mask & collider->mask) != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Compute the squared distance from the given point of the position
+     * of each entity which has a component of the given type.
+     *
+     * @param[in] componentType
+     *     This is the type of component the entities must have.
+     *
+     * @param[in] x
+     *     This is the horizontal coordinate of the point.
+     *
+     * @param[in] y
+     *     This is the vertical coordinate of the point.
+     *
+     * @return
+     *     The number of entities measured is returned.  Their IDs are in
+     *     measuredEntityIds, and their squared distances are in
+     *     squaredDistances, in the same order.
+     */
+    size_t MeasurePositions(
+        const ComponentType& componentType,
+        int x,
+        int y
+    ) {
+        const auto& positionType = componentTypes[(size_t)Type::Position];
+        const auto numComponents = componentType.count();
+        measuredEntityIds.clear();
+        measuredXs.clear();
+        measuredYs.clear();
+        for (size_t i = 1; i <= numComponents; ++i) {
+            const auto entityId = componentType.getEntityId(i);
+            const auto position = (Position*)positionType.get(entityId);
+            if (position == nullptr) {
+                continue;
+            }
+            measuredEntityIds.push_back(entityId);
+            measuredXs.push_back(position->x);
+            measuredYs.push_back(position->y);
+        }
+        const auto n = measuredEntityIds.size();
+        squaredDistances.resize(n);
+        ComputeSquaredDistances(
+            measuredXs.data(),
+            measuredYs.data(),
+            n,
+            x, y,
+            squaredDistances.data()
+        );
+        return n;
+    }
+
+    /**
+     * Find the entities which have a component of the given type and
+     * a position no farther than the given radius from the given point.
+     *
+     * @param[in] componentType
+     *     This is the type of component the entities must have.
+     *
+     * @param[in] x
+     *     This is the horizontal coordinate of the point.
+     *
+     * @param[in] y
+     *     This is the vertical coordinate of the point.
+     *
+     * @param[in] r
+     *     This is the radius.
+     *
+     * @return
+     *     The IDs of the entities found are returned.
+     */
+    std::vector< EntityId > FindWithinRadius(
+        const ComponentType& componentType,
+        int x,
+        int y,
+        int r
+    ) {
+        std::vector< EntityId > entityIds;
+        if (r < 0) {
+            return entityIds;
+        }
+        const auto n = MeasurePositions(componentType, x, y);
+        const auto r2 = (int64_t)r * r;
+        for (size_t i = 0; i < n; ++i) {
+            if (squaredDistances[i] <= r2) {
+                entityIds.push_back(measuredEntityIds[i]);
+            }
+        }
+        return entityIds;
+    }
+
+    /**
+     * Find the entity which has a component of the given type and
+     * a position nearest the given point.
+     *
+     * @param[in] componentType
+     *     This is the type of component the entity must have.
+     *
+     * @param[in] x
+     *     This is the horizontal coordinate of the point.
+     *
+     * @param[in] y
+     *     This is the vertical coordinate of the point.
+     *
+     * @return
+     *     The ID of the entity found is returned, or zero if no entity
+     *     has both a component of the given type and a position.
+     */
+    EntityId FindNearest(
+        const ComponentType& componentType,
+        int x,
+        int y
+    ) {
+        const auto n = MeasurePositions(componentType, x, y);
+        EntityId nearestEntityId = 0;
+        int64_t nearestSquaredDistance = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (
+                (nearestEntityId == 0)
+                || (squaredDistances[i] < nearestSquaredDistance)
+            ) {
+                nearestEntityId = measuredEntityIds[i];
+                nearestSquaredDistance = squaredDistances[i];
+            }
+        }
+        return nearestEntityId;
+    }
+
+    void OnComponentAdded(Type type, EntityId entityId) {
+        ++entityComponentCounts[GetEntityIndex(entityId)];
+        if (
+            (type == Type::Collider)
+            || (type == Type::Position)
+        ) {
+            const auto position = GetColliderPosition(entityId);
+            if (position != nullptr) {
+                AddColliderToCell(entityId, position->x, position->y);
+            }
+        }
+    }
+
+    void OnComponentRemoving(Type type, EntityId entityId) {
+        if (
+            (type == Type::Collider)
+            || (type == Type::Position)
+        ) {
+            const auto position = GetColliderPosition(entityId);
+            if (position != nullptr) {
+                RemoveColliderFromCell(entityId, position->x, position->y);
+            }
+        }
+    }
+
+    void OnComponentRemoved(EntityId entityId) {
+        if (--entityComponentCounts[GetEntityIndex(entityId)] == 0) {
+            ReleaseEntity(entityId);
+        }
+    }
+
+    void KillEntity(EntityId entityId) {
+        if (!IsEntityAlive(entityId)) {
+            return;
+        }
+        for (const auto& componentType: componentTypes) {
+            componentType.kill(entityId);
+        }
+        if (
+            IsEntityAlive(entityId)
+            && (entityComponentCounts[GetEntityIndex(entityId)] == 0)
+        ) {
+            ReleaseEntity(entityId);
+        }
+    }
+
+    /**
+     * Look up the component type given as an argument of a Lua function.
+     * The argument may be either one of the type tokens in components.T,
+     * which is the quickest way, or the name of the component type.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] arg
+     *     This is the stack index of the argument.
+     *
+     * @return
+     *     The component type is returned, or nullptr if the argument
+     *     doesn't identify a component type.
+     */
+    ComponentType* CheckComponentType(lua_State* lua, int arg) {
+        if (lua_type(lua, arg) == LUA_TNUMBER) {
+            const auto type = luaL_checkinteger(lua, arg);
+            if (
+                (type < 0)
+                || (type >= (lua_Integer)componentTypes.size())
+            ) {
+                return nullptr;
+            }
+            return &componentTypes[(size_t)type];
+        }
+        const std::string typeName = luaL_checkstring(lua, arg);
+        const auto componentTypeNamesEntry = componentTypeNames.find(typeName);
+        if (componentTypeNamesEntry == componentTypeNames.end()) {
+            return nullptr;
+        }
+        return &componentTypes[(size_t)componentTypeNamesEntry->second];
+    }
+
+    static int CreateEntity(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto entityId = self->CreateEntity();
+        lua_pushinteger(lua, (lua_Integer)entityId);
+        return 1;
+    }
+
+    static int IsEntityAlive(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto entityId = (EntityId)luaL_checkinteger(lua, 2);
+        lua_pushboolean(lua, self->IsEntityAlive(entityId) ? 1 : 0);
+        return 1;
+    }
+
+    static int CreateComponentOfType(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto componentType = self->CheckComponentType(lua, 2);
+        const auto entityId = (EntityId)luaL_checkinteger(lua, 3);
+        if (componentType == nullptr) {
+            lua_pushnil(lua);
+        } else {
+            (void)componentType->create(entityId);
+            const auto index = componentType->getLuaIndex(entityId);
+            if (index == 0) {
+                lua_pushnil(lua);
+            } else {
+                componentType->push(lua, index);
+            }
+        }
+        return 1;
+    }
+
+    static int DestroyEntityComponentOfType(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto componentType = self->CheckComponentType(lua, 2);
+        const auto entityId = (EntityId)luaL_checkinteger(lua, 3);
+        if (componentType != nullptr) {
+            componentType->destroy(entityId);
+        }
+        return 0;
+    }
+
+    static int DiagnosticMessageFromSystems(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto level = (size_t)std::max((lua_Integer)0, luaL_checkinteger(lua, 2));
+        const std::string message = luaL_checkstring(lua, 3);
+        self->diagnosticsSender->SendDiagnosticInformationString(
+            level,
+            std::string("systems: ") + message
+        );
+        return 0;
+    }
+
+    static int GetEntityComponentOfType(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto componentType = self->CheckComponentType(lua, 2);
+        const auto entityId = (EntityId)luaL_checkinteger(lua, 3);
+        if (componentType == nullptr) {
+            lua_pushnil(lua);
+        } else {
+            auto index = componentType->getLuaIndex(entityId);
+            if (index == 0) {
+                lua_pushnil(lua);
+            } else {
+                componentType->push(lua, index);
+            }
+        }
+        return 1;
+    }
+
+    static int KillEntity(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto entityId = (EntityId)luaL_checkinteger(lua, 2);
+        self->KillEntity(entityId);
+        return 0;
+    }
+
+    static int ColliderAt(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto x = (int)luaL_checkinteger(lua, 2);
+        const auto y = (int)luaL_checkinteger(lua, 3);
+        const auto collider = self->GetColliderAt(x, y);
+        if (collider == nullptr) {
+            lua_pushnil(lua);
+        } else {
+            const auto& colliderType = self->componentTypes[(size_t)Type::Collider];
+            colliderType.push(lua, colliderType.getLuaIndex(collider->entityId));
+        }
+        return 1;
+    }
+
+    /**
+     * Push onto the Lua stack the script component which an iterator
+     * started by Each keeps in the given upvalue, pointed at the given
+     * component.  The script component is created the first time, and
+     * reused after that, so that iterating allocates nothing per
+     * component.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] componentType
+     *     This is the type of the component.
+     *
+     * @param[in] upvalue
+     *     This is the pseudo-index of the upvalue holding the script
+     *     component, which is nil until the script component is created.
+     *
+     * @param[in] index
+     *     This is the Lua index of the component.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity which has the component.
+     */
+    static void PushIteratorComponent(
+        lua_State* lua,
+        const ComponentType& componentType,
+        int upvalue,
+        size_t index,
+        EntityId entityId
+    ) {
+        if (lua_isnil(lua, upvalue)) {
+            componentType.push(lua, index);
+            lua_pushvalue(lua, -1);
+            lua_replace(lua, upvalue);
+        } else {
+            auto scriptComponent = (ScriptComponent*)lua_touserdata(lua, upvalue);
+            scriptComponent->index = index;
+            scriptComponent->entityId = entityId;
+            lua_pushvalue(lua, upvalue);
+        }
+    }
+
+    /**
+     * This is the Lua iterator function returned by Changed.  Its upvalues
+     * are the components object, the type of components to visit, and
+     * the position of the next change to visit.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int ChangedNext(lua_State* lua) {
+        const auto componentType = (const ComponentType*)lua_touserdata(lua, lua_upvalueindex(2));
+        const auto& entityIds = componentType->changes->entityIds;
+        auto next = (size_t)lua_tointeger(lua, lua_upvalueindex(3));
+        while (next < entityIds.size()) {
+            const auto entityId = entityIds[next++];
+            const auto index = componentType->getLuaIndex(entityId);
+            if (index != 0) {
+                lua_pushinteger(lua, (lua_Integer)next);
+                lua_replace(lua, lua_upvalueindex(3));
+                componentType->push(lua, index);
+                return 1;
+            }
+        }
+        lua_pushinteger(lua, (lua_Integer)next);
+        lua_replace(lua, lua_upvalueindex(3));
+        lua_pushnil(lua);
+        return 1;
+    }
+
+    static int Changed(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto componentType = self->CheckComponentType(lua, 2);
+        if (componentType == nullptr) {
+            return luaL_argerror(lua, 2, "unknown component type");
+        }
+        lua_pushvalue(lua, 1);
+        lua_pushlightuserdata(lua, (void*)componentType);
+        lua_pushinteger(lua, 0);
+        lua_pushcclosure(lua, ChangedNext, 3);
+        return 1;
+    }
+
+    /**
+     * This is the Lua iterator function returned by Query and Each.  Its
+     * upvalues are the components object and the QueryState of the
+     * iteration.  For Each, they are followed by one script component for
+     * each type joined.  These are created by the first step and pointed
+     * at the next components by each later step, so that iterating
+     * allocates nothing per entity.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int QueryNext(lua_State* lua) {
+        auto state = (QueryState*)lua_touserdata(lua, lua_upvalueindex(2));
+        const auto& driver = *state->types[state->driver];
+        if (state->cursor.nextMove < driver.moves->numForgotten) {
+            return luaL_error(lua, "query continued after the end of the tick");
+        }
+        size_t indexes[QueryState::maxTypes];
+        size_t index;
+        while ((index = state->cursor.Advance(driver)) != 0) {
+            const auto entityId = driver.getEntityId(index);
+            bool match = true;
+            for (size_t i = 0; i < state->numTypes; ++i) {
+                if (i == state->driver) {
+                    indexes[i] = index;
+                } else {
+                    indexes[i] = state->types[i]->getLuaIndex(entityId);
+                    if (indexes[i] == 0) {
+                        match = false;
+                        break;
+                    }
+                }
+            }
+            if (match) {
+                for (size_t i = 0; i < state->numTypes; ++i) {
+                    if (state->reuse) {
+                        PushIteratorComponent(
+                            lua,
+                            *state->types[i],
+                            lua_upvalueindex((int)i + 3),
+                            indexes[i],
+                            entityId
+                        );
+                    } else {
+                        state->types[i]->push(lua, indexes[i]);
+                    }
+                }
+                return (int)state->numTypes;
+            }
         }
+        lua_pushnil(lua);
         return 1;
     }
 
     /**
-     * This handles Lua newindex metamethod calls for
-     * the global components object.
+     * Return a Lua iterator over the entities which have a component of
+     * every type given, yielding those components for each entity.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
      *
+     * @param[in] reuse
+     *     This indicates whether the iterator should reuse the same script
+     *     components for every step, rather than creating new ones.
+     *
      * @return
      *     The number of return values that have been pushed onto the
      *     Lua stack by the function as return values of the function
      *     is returned.
      */
-    static int NewIndex(lua_State* lua) {
+    static int StartQuery(lua_State* lua, bool reuse) {
         auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        const std::string fieldName = luaL_checkstring(lua, 2);
-        luaL_getmetatable(lua, "components");
-        lua_insert(lua, 2);
-        lua_rawset(lua, 2);
-        return 0;
+        const auto numTypes = (size_t)lua_gettop(lua) - 1;
+        luaL_argcheck(lua, numTypes > 0, 2, "no component types given");
+        luaL_argcheck(lua, numTypes <= QueryState::maxTypes, 2, "too many component types given");
+        auto state = (QueryState*)lua_newuserdata(lua, sizeof(QueryState));
+        new (state) QueryState();
+        state->numTypes = numTypes;
+        state->reuse = reuse;
+        for (size_t i = 0; i < numTypes; ++i) {
+            state->types[i] = self->CheckComponentType(lua, (int)i + 2);
+            if (state->types[i] == nullptr) {
+                return luaL_argerror(lua, (int)i + 2, "unknown component type");
+            }
+            if (state->types[i]->count() < state->types[state->driver]->count()) {
+                state->driver = i;
+            }
+        }
+        state->cursor.nextMove = state->types[state->driver]->moves->End();
+        lua_pushvalue(lua, 1);
+        lua_insert(lua, -2);
+        if (!reuse) {
+            lua_pushcclosure(lua, QueryNext, 2);
+            return 1;
+        }
+        luaL_checkstack(lua, (int)numTypes, "too many component types given");
+        for (size_t i = 0; i < numTypes; ++i) {
+            lua_pushnil(lua);
+        }
+        lua_pushcclosure(lua, QueryNext, (int)numTypes + 2);
+        return 1;
+    }
+
+    static int Query(lua_State* lua) {
+        return StartQuery(lua, false);
     }
 
     /**
-     * This handles Lua tostring metamethod calls for
-     * the global components object.
+     * This is a Lua function registered as the Each method of the
+     * components object.  It works like Query, except that each step
+     * points the same script components at the next entity's components,
+     * rather than creating new ones, so iterating makes no garbage.
+     * Scripts which use it must not hold onto a yielded component beyond
+     * the step which yielded it, since it refers to a different component
+     * after the next step.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
@@ -100,84 +1489,156 @@ struct Components::Impl {
      *     Lua stack by the function as return values of the function
      *     is returned.
      */
-    static int ToString(lua_State* lua) {
+    static int Each(lua_State* lua) {
+        return StartQuery(lua, true);
+    }
+
+    static int WithinRadius(lua_State* lua) {
         auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        lua_pushstring(lua, "components()");
+        const auto componentType = self->CheckComponentType(lua, 2);
+        const auto x = (int)luaL_checkinteger(lua, 3);
+        const auto y = (int)luaL_checkinteger(lua, 4);
+        const auto r = (int)luaL_checkinteger(lua, 5);
+        if (componentType == nullptr) {
+            return luaL_argerror(lua, 2, "unknown component type");
+        }
+        const auto entityIds = self->FindWithinRadius(*componentType, x, y, r);
+        lua_createtable(lua, (int)entityIds.size(), 0);
+        for (size_t i = 0; i < entityIds.size(); ++i) {
+            componentType->push(lua, componentType->getLuaIndex(entityIds[i]));
+            lua_rawseti(lua, -2, (lua_Integer)i + 1);
+        }
         return 1;
     }
 
-    static int CreateEntity(lua_State* lua) {
+    static int Nearest(lua_State* lua) {
         auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        const auto entityId = self->nextEntityId++;
-        lua_pushinteger(lua, (lua_Integer)entityId);
+        const auto componentType = self->CheckComponentType(lua, 2);
+        const auto x = (int)luaL_checkinteger(lua, 3);
+        const auto y = (int)luaL_checkinteger(lua, 4);
+        if (componentType == nullptr) {
+            return luaL_argerror(lua, 2, "unknown component type");
+        }
+        const auto entityId = self->FindNearest(*componentType, x, y);
+        if (entityId == 0) {
+            lua_pushnil(lua);
+            return 1;
+        }
+        const auto& positionType = self->componentTypes[(size_t)Type::Position];
+        componentType->push(lua, componentType->getLuaIndex(entityId));
+        positionType.push(lua, positionType.getLuaIndex(entityId));
+        return 2;
+    }
+
+    static int Blocked(lua_State* lua) {
+        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
+        const auto x = (int)luaL_checkinteger(lua, 2);
+        const auto y = (int)luaL_checkinteger(lua, 3);
+        const auto mask = (int)luaL_checkinteger(lua, 4);
+        lua_pushboolean(lua, self->IsObstacleInTheWay(x, y, mask) ? 1 : 0);
         return 1;
     }
 
-    static int CreateComponentOfType(lua_State* lua) {
+    static int StaticTileAt(lua_State* lua) {
         auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        const std::string typeName = luaL_checkstring(lua, 2);
-        const auto entityId = (int)luaL_checkinteger(lua, 3);
-        const auto componentTypeNamesEntry = self->componentTypeNames.find(typeName);
-        if (componentTypeNamesEntry == self->componentTypeNames.end()) {
+        const auto x = (int)luaL_checkinteger(lua, 2);
+        const auto y = (int)luaL_checkinteger(lua, 3);
+        const auto staticTile = self->GetStaticTile(x, y);
+        if (staticTile == nullptr) {
             lua_pushnil(lua);
         } else {
-            const auto& componentType = self->componentTypes[componentTypeNamesEntry->second];
-            const auto component = componentType.create(entityId);
-            const auto list = componentType.list();
-            componentType.push(lua, list.n);
+            self->PushAtom(lua, staticTile->name);
         }
         return 1;
     }
 
-    static int DestroyEntityComponentOfType(lua_State* lua) {
-        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        const std::string typeName = luaL_checkstring(lua, 2);
-        const auto entityId = (int)luaL_checkinteger(lua, 3);
-        const auto componentTypeNamesEntry = self->componentTypeNames.find(typeName);
-        if (componentTypeNamesEntry != self->componentTypeNames.end()) {
-            const auto& componentType = self->componentTypes[componentTypeNamesEntry->second];
-            componentType.destroy(entityId);
-        }
+    /**
+     * This is the type of function which implements a Lua function or
+     * metamethod for one component type.  It carries the storage of the
+     * component type it serves, so that each Lua interpreter is bound
+     * to the storage of its own game.
+     */
+    typedef std::function< int(lua_State* lua) > Binding;
+
+    /**
+     * This is a Lua function registered as the __gc
+     * object metamethod of the "binding" class.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     */
+    static int BindingFinalizer(lua_State* lua) {
+        auto binding = (Binding*)luaL_checkudata(lua, 1, "binding");
+        binding->~Binding();
         return 0;
     }
 
-    static int DiagnosticMessageFromSystems(lua_State* lua) {
-        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        const auto level = (size_t)std::max((lua_Integer)0, luaL_checkinteger(lua, 2));
-        const std::string message = luaL_checkstring(lua, 3);
-        self->diagnosticsSender->SendDiagnosticInformationString(
-            level,
-            std::string("systems: ") + message
-        );
-        return 0;
+    /**
+     * This is the Lua function through which bindings are called.
+     * Its first upvalue is the binding to call.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int CallBinding(lua_State* lua) {
+        const auto binding = (Binding*)lua_touserdata(lua, lua_upvalueindex(1));
+        return (*binding)(lua);
     }
 
-    static int GetEntityComponentOfType(lua_State* lua) {
-        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        const std::string typeName = luaL_checkstring(lua, 2);
-        const auto entityId = (int)luaL_checkinteger(lua, 3);
-        const auto componentTypeNamesEntry = self->componentTypeNames.find(typeName);
-        if (componentTypeNamesEntry == self->componentTypeNames.end()) {
-            lua_pushnil(lua);
-        } else {
-            const auto type = componentTypeNamesEntry->second;
-            auto index = self->componentTypes[type].getLuaIndex(entityId);
-            if (index == 0) {
-                lua_pushnil(lua);
-            } else {
-                self->componentTypes[type].push(lua, index);
-            }
-        }
-        return 1;
+    /**
+     * Push onto the Lua stack a Lua function which calls the given
+     * binding.  The binding is kept in a userdata owned by the Lua
+     * interpreter, which is the first upvalue of the function.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] binding
+     *     This is the binding to call.
+     *
+     * @param[in] numUpvalues
+     *     This is the number of values on the top of the Lua stack
+     *     to pop and give to the function as its remaining upvalues.
+     */
+    static void PushBinding(
+        lua_State* lua,
+        const Binding& binding,
+        int numUpvalues
+    ) {
+        auto bindingWrapper = (Binding*)lua_newuserdata(lua, sizeof(Binding));
+        new (bindingWrapper) Binding(binding);
+        luaL_setmetatable(lua, "binding");
+        lua_insert(lua, -1 - numUpvalues);
+        lua_pushcclosure(lua, CallBinding, numUpvalues + 1);
     }
 
-    static int KillEntity(lua_State* lua) {
-        auto self = *(std::shared_ptr< Impl >*)luaL_checkudata(lua, 1, "components");
-        const auto entityId = (int)luaL_checkinteger(lua, 2);
-        for (const auto& componentType: self->componentTypes) {
-            componentType.second.kill(entityId);
+    /**
+     * Push onto the Lua stack a table which maps the name of each of the
+     * given properties to a light userdata pointing to the function which
+     * handles the property.  Since Lua strings are interned, looking up
+     * a field in this table builds no strings.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] properties
+     *     These are the properties to put in the table.  They must
+     *     outlive the table.
+     */
+    template< typename T > static void PushFieldTable(
+        lua_State* lua,
+        const LuaPropertyMap< T >& properties
+    ) {
+        lua_createtable(lua, 0, (int)properties.size());
+        for (const auto& property: properties) {
+            lua_pushlightuserdata(lua, (void*)&property.second);
+            lua_setfield(lua, -2, property.first.c_str());
         }
-        return 0;
     }
 
     template< typename T > void MakeComponentType(
@@ -185,225 +1646,254 @@ struct Components::Impl {
         lua_State* lua,
         const std::string& collectionWrapperName,
         const std::string& componentWrapperName,
-        std::function< int(lua_State* lua) >& collectionIndex,
-        lua_CFunction collectionIndexThunk,
-        std::function< int(lua_State* lua) >& collectionLen,
-        lua_CFunction collectionLenThunk,
-        std::function< int(lua_State* lua) >& collectionIterate,
-        lua_CFunction collectionIterateThunk,
-        std::function< int(lua_State* lua) >& componentIndex,
-        lua_CFunction componentIndexThunk,
-        std::function< int(lua_State* lua) >& componentNewIndex,
-        lua_CFunction componentNewIndexThunk,
         std::shared_ptr< LuaPropertyMap< T > > indexers = std::make_shared< LuaPropertyMap< T > >(),
         std::shared_ptr< LuaPropertyMap< T > > newIndexers = std::make_shared< LuaPropertyMap< T > >(),
-        std::function<
-            void(
-                std::vector< T >& components,
-                int entityId
-            )
-        > kill = nullptr
+        std::function< void(T& component) > kill = nullptr,
+        const std::vector< int T::* >& columnFields = {}
     ) {
         (void)collectionTypeNames.insert(collectionWrapperName);
         componentTypeNames[componentWrapperName] = type;
-        struct ScriptComponent {
-            size_t index;
-            T* component;
-        };
         ComponentType componentType;
-        const auto components = std::make_shared< std::vector< T > >();
-        const auto list = [components]{
+        const auto components = std::make_shared< PagedVector< T > >();
+        const auto slots = std::make_shared< std::vector< size_t > >();
+        componentType.list = [components]{
             Components::ComponentList list;
-            list.first = components->data();
+            const auto numPages = components->GetNumPages();
+            list.pages.resize(numPages);
+            for (size_t i = 0; i < numPages; ++i) {
+                list.pages[i].first = components->GetPage(i);
+                list.pages[i].n = components->GetPageSize(i);
+            }
             list.n = components->size();
             return list;
         };
-        componentType.list = list;
-        componentType.create = [components](int entityId){
-            Component* component;
-            const auto i = components->size();
-            components->resize(i + 1);
-            component = &(*components)[i];
+
+        // If fields are given for column storage, copies of them are
+        // kept in columns which follow every change to the order of
+        // the components, and every write made through Lua or through
+        // Components::MarkChanged.
+        const auto columned = !columnFields.empty();
+        const auto columns = std::make_shared< ComponentColumnStorage >();
+        columns->fields.resize(columnFields.size());
+        const auto changes = std::make_shared< ChangeSet >();
+        const auto storage = std::make_shared< ComponentStorage< T > >();
+        storage->components = components;
+        storage->slots = slots;
+        storage->columns = columns;
+        storage->columnFields = columnFields;
+        storage->changes = changes;
+        storage->indexers = indexers;
+        storage->newIndexers = newIndexers;
+        componentType.storage = storage;
+        const auto updateColumns = [storage](size_t index){
+            storage->UpdateColumns(index);
+        };
+        componentType.columnsMatch = [components, columns, columnFields]{
+            if (columnFields.empty()) {
+                return true;
+            }
+            if (columns->entityIds.size() != components->size()) {
+                return false;
+            }
+            for (size_t index = 0; index < columns->entityIds.size(); ++index) {
+                const auto& component = (*components)[index];
+                if (columns->entityIds[index] != component.entityId) {
+                    return false;
+                }
+                for (size_t i = 0; i < columnFields.size(); ++i) {
+                    if (columns->fields[i][index] != component.*columnFields[i]) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        };
+        componentType.columns = [columns]{
+            Components::ComponentColumns view;
+            view.entityIds = columns->entityIds.data();
+            for (const auto& field: columns->fields) {
+                view.fields.push_back(field.data());
+            }
+            view.n = columns->entityIds.size();
+            return view;
+        };
+        componentType.changes = changes;
+        const auto moves = std::make_shared< MoveLog >();
+        componentType.moves = moves;
+        componentType.create = [this, type, components, slots, columned, columns, updateColumns, changes](EntityId entityId){
+            if (!IsEntityAlive(entityId)) {
+                return (Component*)nullptr;
+            }
+            const auto entityIndex = GetEntityIndex(entityId);
+            if (entityIndex >= slots->size()) {
+                slots->resize((size_t)entityIndex + 1);
+            }
+            auto& slot = (*slots)[entityIndex];
+            if (slot != 0) {
+                return (Component*)&(*components)[slot - 1];
+            }
+            Component* component = &components->emplace_back();
             component->entityId = entityId;
+            slot = components->size();
+            if (columned) {
+                columns->entityIds.push_back(entityId);
+                for (auto& field: columns->fields) {
+                    field.push_back(0);
+                }
+                updateColumns(slot);
+            }
+            changes->Mark(entityId);
+            OnComponentAdded(type, entityId);
             return component;
         };
-        componentType.destroy = [components](int entityId){
-            auto componentsEntry = components->begin();
-            while (componentsEntry != components->end()) {
-                if (componentsEntry->entityId == entityId) {
-                    componentsEntry = components->erase(componentsEntry);
-                    break;
-                } else {
-                    ++componentsEntry;
+        const auto getLuaIndex = [storage](EntityId entityId){
+            return storage->GetLuaIndex(entityId);
+        };
+        componentType.getLuaIndex = getLuaIndex;
+        componentType.markChanged = [storage](EntityId entityId){
+            const auto index = storage->GetLuaIndex(entityId);
+            if (index == 0) {
+                return;
+            }
+            storage->MarkChanged(index);
+        };
+        componentType.destroy = [this, type, components, slots, getLuaIndex, columned, columns, updateColumns, moves](EntityId entityId){
+            const auto index = getLuaIndex(entityId);
+            if (index == 0) {
+                return;
+            }
+            OnComponentRemoving(type, entityId);
+            (*slots)[GetEntityIndex(entityId)] = 0;
+            if (index != components->size()) {
+                auto& component = (*components)[index - 1];
+                component = std::move(components->back());
+                (*slots)[GetEntityIndex(component.entityId)] = index;
+                moves->moves.push_back({component.entityId, components->size(), index});
+                if (columned) {
+                    updateColumns(index);
+                }
+            }
+            components->pop_back();
+            if (columned) {
+                columns->entityIds.pop_back();
+                for (auto& field: columns->fields) {
+                    field.pop_back();
                 }
             }
+            OnComponentRemoved(entityId);
         };
         if (kill == nullptr) {
             componentType.kill = componentType.destroy;
         } else {
-            componentType.kill = [components, kill](int entityId) {
-                kill(*components, entityId);
+            componentType.kill = [components, kill, getLuaIndex, changes](EntityId entityId) {
+                const auto index = getLuaIndex(entityId);
+                if (index != 0) {
+                    kill((*components)[index - 1]);
+                    changes->Mark(entityId);
+                }
             };
         }
-        componentType.get = [components](int entityId){
-            const auto n = components->size();
-            for (size_t i = 0; i < n; ++i) {
-                if ((*components)[i].entityId == entityId) {
-                    return &(*components)[i];
-                }
-            }
-            return (T*)nullptr;
-        };
-        componentType.getLuaIndex = [components](int entityId){
-            const auto n = components->size();
-            for (size_t i = 0; i < n; ++i) {
-                if ((*components)[i].entityId == entityId) {
-                    return i + 1;
-                }
+        componentType.get = [components, getLuaIndex](EntityId entityId){
+            const auto index = getLuaIndex(entityId);
+            if (index == 0) {
+                return (T*)nullptr;
             }
-            return (size_t)0;
+            return &(*components)[index - 1];
         };
-        const auto push = [list, componentWrapperName](lua_State* lua, size_t index) {
-            auto componentsInfo = list();
-            auto& component = ((T*)componentsInfo.first)[index - 1];
+        const auto push = [components, componentWrapperName](lua_State* lua, size_t index) {
             auto scriptComponent = (ScriptComponent*)lua_newuserdata(lua, sizeof(ScriptComponent));
+            new (scriptComponent) ScriptComponent();
             scriptComponent->index = index;
-            scriptComponent->component = &component;
+            scriptComponent->entityId = (*components)[index - 1].entityId;
             luaL_setmetatable(lua, componentWrapperName.c_str());
         };
+
         componentType.push = push;
-        collectionIndex = [list, push, collectionWrapperName, componentWrapperName](lua_State* lua){
+        componentType.count = [components]{
+            return components->size();
+        };
+        componentType.getEntityId = [components](size_t index){
+            return (*components)[index - 1].entityId;
+        };
+        const Binding collectionIndex = [components, push, collectionWrapperName](lua_State* lua){
             (void)luaL_checkudata(lua, 1, collectionWrapperName.c_str());
             const auto index = (size_t)std::max((lua_Integer)0, luaL_checkinteger(lua, 2));
-            auto componentsInfo = list();
             if (
                 (index == 0)
-                || (index > componentsInfo.n)
+                || (index > components->size())
             ) {
                 lua_pushnil(lua);
+            } else {
+                push(lua, index);
             }
-            push(lua, index);
             return 1;
         };
-        collectionLen = [list, collectionWrapperName](lua_State* lua){
+        const Binding collectionLen = [components, collectionWrapperName](lua_State* lua){
             (void)luaL_checkudata(lua, 1, collectionWrapperName.c_str());
-            auto componentsInfo = list();
-            lua_pushinteger(lua, (lua_Integer)componentsInfo.n);
+            lua_pushinteger(lua, (lua_Integer)components->size());
             return 1;
         };
-        collectionIterate = [list, push, collectionWrapperName, componentWrapperName](lua_State* lua){
+        const Binding collectionIterate = [this, type, moves, push, collectionWrapperName, componentWrapperName](lua_State* lua){
             (void)luaL_checkudata(lua, 1, collectionWrapperName.c_str());
-            auto componentsInfo = list();
             luaL_checkany(lua, 3);
-            size_t index;
+            IterationCursor cursor;
             if (lua_isnil(lua, 3)) {
-                index = 1;
+                cursor.nextMove = moves->End();
             } else {
-                auto lastComponent = (ScriptComponent*)luaL_checkudata(lua, 3, componentWrapperName.c_str());
-                index = lastComponent->index + 1;
+                const auto lastComponent = (ScriptComponent*)luaL_checkudata(lua, 3, componentWrapperName.c_str());
+                cursor = lastComponent->cursor;
+                if (cursor.nextMove < moves->numForgotten) {
+                    return luaL_error(lua, "iteration continued after the end of the tick");
+                }
             }
-            if (index > componentsInfo.n) {
+            const auto index = cursor.Advance(componentTypes[(size_t)type]);
+            if (index == 0) {
                 lua_pushnil(lua);
-            } else {
-                push(lua, index);
-            }
-            return 1;
-        };
-        componentIndex = [componentWrapperName, indexers](lua_State* lua){
-            auto self = (ScriptComponent*)luaL_checkudata(lua, 1, componentWrapperName.c_str());
-            const std::string fieldName = luaL_checkstring(lua, 2);
-            if (fieldName == "entityId") {
-                lua_pushinteger(lua, self->component->entityId);
-            } else {
-                const auto indexersEntry = indexers->find(fieldName);
-                if (indexersEntry == indexers->end()) {
-                    lua_pushnil(lua);
-                } else {
-                    indexersEntry->second(lua, self->component);
-                }
+                return 1;
             }
+            push(lua, index);
+            ((ScriptComponent*)lua_touserdata(lua, -1))->cursor = cursor;
             return 1;
         };
-        componentNewIndex = [componentWrapperName, newIndexers](lua_State* lua){
-            auto self = (ScriptComponent*)luaL_checkudata(lua, 1, componentWrapperName.c_str());
-            const std::string fieldName = luaL_checkstring(lua, 2);
-            const auto newIndexersEntry = newIndexers->find(fieldName);
-            if (newIndexersEntry != newIndexers->end()) {
-                newIndexersEntry->second(lua, self->component);
-            }
-            return 0;
-        };
-
         // Collection
         luaL_newmetatable(lua, collectionWrapperName.c_str());
         lua_pushstring(lua, "__index");
-        lua_pushcfunction(lua, collectionIndexThunk);
+        PushBinding(lua, collectionIndex, 0);
         lua_settable(lua, -3);
         lua_pushstring(lua, "__len");
-        lua_pushcfunction(lua, collectionLenThunk);
+        PushBinding(lua, collectionLen, 0);
         lua_settable(lua, -3);
         lua_pushstring(lua, "__call");
-        lua_pushcfunction(lua, collectionIterateThunk);
+        PushBinding(lua, collectionIterate, 0);
         lua_settable(lua, -3);
         lua_pop(lua, 1);
 
         // Component
         luaL_newmetatable(lua, componentWrapperName.c_str());
         lua_pushstring(lua, "__index");
-        lua_pushcfunction(lua, componentIndexThunk);
+        lua_pushlightuserdata(lua, storage.get());
+        PushFieldTable(lua, *indexers);
+        lua_pushvalue(lua, -4);
+        lua_pushstring(lua, "entityId");
+        lua_pushlightuserdata(lua, this);
+        lua_pushcclosure(lua, ComponentStorage< T >::Index, 5);
         lua_settable(lua, -3);
         lua_pushstring(lua, "__newindex");
-        lua_pushcfunction(lua, componentNewIndexThunk);
+        lua_pushlightuserdata(lua, storage.get());
+        PushFieldTable(lua, *newIndexers);
+        lua_pushvalue(lua, -4);
+        lua_pushstring(lua, "entityId");
+        lua_pushlightuserdata(lua, this);
+        lua_pushcclosure(lua, ComponentStorage< T >::NewIndex, 5);
         lua_settable(lua, -3);
         lua_pop(lua, 1);
-        componentTypes[type] = std::move(componentType);
+        if ((size_t)type >= componentTypes.size()) {
+            componentTypes.resize((size_t)type + 1);
+        }
+        componentTypes[(size_t)type] = std::move(componentType);
     }
 };
 
-#define MAKE_COLLECTION_INDEX_THUNK(type) \
-    std::function< int(lua_State* lua) > type##CollectionIndex; \
-    int type##CollectionIndexThunk(lua_State* lua) { \
-        return type##CollectionIndex(lua); \
-    }
-
-#define MAKE_COLLECTION_LEN_THUNK(type) \
-    std::function< int(lua_State* lua) > type##CollectionLen; \
-    int type##CollectionLenThunk(lua_State* lua) { \
-        return type##CollectionLen(lua); \
-    }
-
-#define MAKE_COLLECTION_ITERATE_THUNK(type) \
-    std::function< int(lua_State* lua) > type##CollectionIterate; \
-    int type##CollectionIterateThunk(lua_State* lua) { \
-        return type##CollectionIterate(lua); \
-    }
-
-#define MAKE_COMPONENT_INDEX_THUNK(type) \
-    std::function< int(lua_State* lua) > type##ComponentIndex; \
-    int type##ComponentIndexThunk(lua_State* lua) { \
-        return type##ComponentIndex(lua); \
-    }
-
-#define MAKE_COMPONENT_NEW_INDEX_THUNK(type) \
-    std::function< int(lua_State* lua) > type##ComponentNewIndex; \
-    int type##ComponentNewIndexThunk(lua_State* lua) { \
-        return type##ComponentNewIndex(lua); \
-    }
-
-#define MAKE_THUNKS(type) \
-    MAKE_COLLECTION_INDEX_THUNK(type) \
-    MAKE_COLLECTION_LEN_THUNK(type) \
-    MAKE_COLLECTION_ITERATE_THUNK(type) \
-    MAKE_COMPONENT_INDEX_THUNK(type) \
-    MAKE_COMPONENT_NEW_INDEX_THUNK(type)
-
-#define PASS_THUNKS(type) \
-    type##CollectionIndex, type##CollectionIndexThunk, \
-    type##CollectionLen, type##CollectionLenThunk, \
-    type##CollectionIterate, type##CollectionIterateThunk, \
-    type##ComponentIndex, type##ComponentIndexThunk, \
-    type##ComponentNewIndex, type##ComponentNewIndexThunk
-
 Components::~Components() noexcept = default;
 
 Components::Components()
@@ -417,6 +1907,10 @@ void Components::SetDiagnosticsSender(
     impl_->diagnosticsSender = diagnosticsSender;
 }
 
+void Components::SetAtomTable(std::shared_ptr< AtomTable > atoms) {
+    impl_->atoms = atoms;
+}
+
 void Components::LinkLua(lua_State* lua) {
     // Components
     luaL_newmetatable(lua, "components");
@@ -432,6 +1926,15 @@ void Components::LinkLua(lua_State* lua) {
     lua_pushstring(lua, "__tostring");
     lua_pushcfunction(lua, Impl::ToString);
     lua_settable(lua, -3);
+    lua_pushstring(lua, "Blocked");
+    lua_pushcfunction(lua, Impl::Blocked);
+    lua_settable(lua, -3);
+    lua_pushstring(lua, "Changed");
+    lua_pushcfunction(lua, Impl::Changed);
+    lua_settable(lua, -3);
+    lua_pushstring(lua, "ColliderAt");
+    lua_pushcfunction(lua, Impl::ColliderAt);
+    lua_settable(lua, -3);
     lua_pushstring(lua, "CreateEntity");
     lua_pushcfunction(lua, Impl::CreateEntity);
     lua_settable(lua, -3);
@@ -444,33 +1947,49 @@ void Components::LinkLua(lua_State* lua) {
     lua_pushstring(lua, "DiagnosticMessage");
     lua_pushcfunction(lua, Impl::DiagnosticMessageFromSystems);
     lua_settable(lua, -3);
+    lua_pushstring(lua, "Each");
+    lua_pushcfunction(lua, Impl::Each);
+    lua_settable(lua, -3);
     lua_pushstring(lua, "GetEntityComponentOfType");
     lua_pushcfunction(lua, Impl::GetEntityComponentOfType);
     lua_settable(lua, -3);
+    lua_pushstring(lua, "IsEntityAlive");
+    lua_pushcfunction(lua, Impl::IsEntityAlive);
+    lua_settable(lua, -3);
+    lua_pushstring(lua, "Nearest");
+    lua_pushcfunction(lua, Impl::Nearest);
+    lua_settable(lua, -3);
+    lua_pushstring(lua, "Query");
+    lua_pushcfunction(lua, Impl::Query);
+    lua_settable(lua, -3);
+    lua_pushstring(lua, "StaticTileAt");
+    lua_pushcfunction(lua, Impl::StaticTileAt);
+    lua_settable(lua, -3);
     lua_pushstring(lua, "KillEntity");
     lua_pushcfunction(lua, Impl::KillEntity);
     lua_settable(lua, -3);
+    lua_pushstring(lua, "WithinRadius");
+    lua_pushcfunction(lua, Impl::WithinRadius);
+    lua_settable(lua, -3);
     lua_pop(lua, 1);
-}
 
-MAKE_THUNKS(Collider)
-MAKE_THUNKS(Generator)
-MAKE_THUNKS(Health)
-MAKE_THUNKS(Hero)
-MAKE_THUNKS(Input)
-MAKE_THUNKS(Monster)
-MAKE_THUNKS(Pickup)
-MAKE_THUNKS(Position)
-MAKE_THUNKS(Reward)
-MAKE_THUNKS(Tile)
-MAKE_THUNKS(Weapon)
+    // Atoms
+    lua_newtable(lua);
+    lua_rawsetp(lua, LUA_REGISTRYINDEX, &atomCacheKey);
+
+    // Bindings
+    luaL_newmetatable(lua, "binding");
+    lua_pushstring(lua, "__gc");
+    lua_pushcfunction(lua, Impl::BindingFinalizer);
+    lua_settable(lua, -3);
+    lua_pop(lua, 1);
+}
 
 void Components::BuildComponentTypeMap(lua_State* lua) {
     impl_->MakeComponentType< Collider >(
         Type::Collider,
         lua,
         "colliders", "collider",
-        PASS_THUNKS(Collider),
         std::make_shared< LuaPropertyMap< Collider > >(
             std::initializer_list< LuaPropertyMap< Collider >::value_type >{
                 {"mask", [](lua_State* lua, Collider* component){
@@ -485,13 +2004,14 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
                     component->mask = mask;
                 }},
             }
-        )
+        ),
+        nullptr,
+        {&Collider::mask}
     );
     impl_->MakeComponentType< Generator >(
         Type::Generator,
         lua,
         "generators", "generator",
-        PASS_THUNKS(Generator),
         std::make_shared< LuaPropertyMap< Generator > >(
             std::initializer_list< LuaPropertyMap< Generator >::value_type >{
                 {"spawnChance", [](lua_State* lua, Generator* component){
@@ -512,7 +2032,6 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
         Type::Health,
         lua,
         "healths", "health",
-        PASS_THUNKS(Health),
         std::make_shared< LuaPropertyMap< Health > >(
             std::initializer_list< LuaPropertyMap< Health >::value_type >{
                 {"hp", [](lua_State* lua, Health* component){
@@ -528,17 +2047,13 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
                 }},
             }
         ),
-        [](
-            std::vector< Health >& components,
-            int entityId
-        ){
-        }
+        nullptr,
+        {&Health::hp}
     );
     impl_->MakeComponentType< Hero >(
         Type::Hero,
         lua,
         "heroes", "hero",
-        PASS_THUNKS(Hero),
         std::make_shared< LuaPropertyMap< Hero > >(
             std::initializer_list< LuaPropertyMap< Hero >::value_type >{
                 {"score", [](lua_State* lua, Hero* component){
@@ -561,17 +2076,15 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
                 }},
             }
         ),
-        [](
-            std::vector< Hero >& components,
-            int entityId
-        ){
+        // A killed hero keeps its Hero component, so that the final
+        // score and potions are still shown after the game is over.
+        [](Hero& component){
         }
     );
     impl_->MakeComponentType< Input >(
         Type::Input,
         lua,
         "inputs", "input",
-        PASS_THUNKS(Input),
         std::make_shared< LuaPropertyMap< Input > >(
             std::initializer_list< LuaPropertyMap< Input >::value_type >{
                 {"fire", [](lua_State* lua, Input* component){
@@ -657,14 +2170,12 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
     impl_->MakeComponentType< Monster >(
         Type::Monster,
         lua,
-        "monsters", "monster",
-        PASS_THUNKS(Monster)
+        "monsters", "monster"
     );
     impl_->MakeComponentType< Pickup >(
         Type::Pickup,
         lua,
         "pickups", "pickup",
-        PASS_THUNKS(Pickup),
         std::make_shared< LuaPropertyMap< Pickup > >(
             std::initializer_list< LuaPropertyMap< Pickup >::value_type >{
                 {"type", [](lua_State* lua, Pickup* component){
@@ -711,7 +2222,6 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
         Type::Position,
         lua,
         "position", "position",
-        PASS_THUNKS(Position),
         std::make_shared< LuaPropertyMap< Position > >(
             std::initializer_list< LuaPropertyMap< Position >::value_type >{
                 {"x", [](lua_State* lua, Position* component){
@@ -725,21 +2235,24 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
         std::make_shared< LuaPropertyMap< Position > >(
             std::initializer_list< LuaPropertyMap< Position >::value_type >{
                 {"x", [](lua_State* lua, Position* component){
+                    const auto impl = Impl::GetFieldOwner(lua);
                     const auto x = (int)luaL_checkinteger(lua, 3);
-                    component->x = x;
+                    impl->MovePosition(*component, x, component->y);
                 }},
                 {"y", [](lua_State* lua, Position* component){
+                    const auto impl = Impl::GetFieldOwner(lua);
                     const auto y = (int)luaL_checkinteger(lua, 3);
-                    component->y = y;
+                    impl->MovePosition(*component, component->x, y);
                 }},
             }
-        )
+        ),
+        nullptr,
+        {&Position::x, &Position::y}
     );
     impl_->MakeComponentType< Reward >(
         Type::Reward,
         lua,
         "rewards", "reward",
-        PASS_THUNKS(Reward),
         std::make_shared< LuaPropertyMap< Reward > >(
             std::initializer_list< LuaPropertyMap< Reward >::value_type >{
                 {"score", [](lua_State* lua, Reward* component){
@@ -760,11 +2273,11 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
         Type::Tile,
         lua,
         "tiles", "tile",
-        PASS_THUNKS(Tile),
         std::make_shared< LuaPropertyMap< Tile > >(
             std::initializer_list< LuaPropertyMap< Tile >::value_type >{
                 {"name", [](lua_State* lua, Tile* component){
-                    lua_pushstring(lua, component->name.c_str());
+                    const auto impl = Impl::GetFieldOwner(lua);
+                    impl->PushAtom(lua, component->name);
                 }},
                 {"z", [](lua_State* lua, Tile* component){
                     lua_pushinteger(lua, (lua_Integer)component->z);
@@ -775,9 +2288,6 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
                 {"spinning", [](lua_State* lua, Tile* component){
                     lua_pushboolean(lua, component->spinning ? 1 : 0);
                 }},
-                {"dirty", [](lua_State* lua, Tile* component){
-                    lua_pushboolean(lua, component->dirty ? 1 : 0);
-                }},
                 {"destroyed", [](lua_State* lua, Tile* component){
                     lua_pushboolean(lua, component->destroyed ? 1 : 0);
                 }},
@@ -786,7 +2296,8 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
         std::make_shared< LuaPropertyMap< Tile > >(
             std::initializer_list< LuaPropertyMap< Tile >::value_type >{
                 {"name", [](lua_State* lua, Tile* component){
-                    component->name = luaL_checkstring(lua, 3);
+                    const auto impl = Impl::GetFieldOwner(lua);
+                    component->name = impl->CheckAtom(lua, 3);
                 }},
                 {"z", [](lua_State* lua, Tile* component){
                     const auto z = (int)luaL_checkinteger(lua, 3);
@@ -800,33 +2311,20 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
                     luaL_checkany(lua, 3);
                     component->spinning = (lua_toboolean(lua, 3) != 0);
                 }},
-                {"dirty", [](lua_State* lua, Tile* component){
-                    luaL_checkany(lua, 3);
-                    component->dirty = (lua_toboolean(lua, 3) != 0);
-                }},
                 {"destroyed", [](lua_State* lua, Tile* component){
                     luaL_checkany(lua, 3);
                     component->destroyed = (lua_toboolean(lua, 3) != 0);
                 }},
             }
         ),
-        [](
-            std::vector< Tile >& components,
-            int entityId
-        ){
-            for (auto& component: components) {
-                if (component.entityId == entityId) {
-                    component.destroyed = true;
-                    break;
-                }
-            }
+        [](Tile& component){
+            component.destroyed = true;
         }
     );
     impl_->MakeComponentType< Weapon >(
         Type::Weapon,
         lua,
         "weapons", "weapon",
-        PASS_THUNKS(Weapon),
         std::make_shared< LuaPropertyMap< Weapon > >(
             std::initializer_list< LuaPropertyMap< Weapon >::value_type >{
                 {"dx", [](lua_State* lua, Weapon* component){
@@ -851,12 +2349,24 @@ void Components::BuildComponentTypeMap(lua_State* lua) {
                     component->dy = dy;
                 }},
                 {"ownerId", [](lua_State* lua, Weapon* component){
-                    const auto ownerId = (int)luaL_checkinteger(lua, 3);
+                    const auto ownerId = (EntityId)luaL_checkinteger(lua, 3);
                     component->ownerId = ownerId;
                 }},
             }
-        )
+        ),
+        nullptr,
+        {&Weapon::dx, &Weapon::dy}
     );
+
+    // Type tokens
+    luaL_getmetatable(lua, "components");
+    lua_newtable(lua);
+    for (const auto& componentTypeNamesEntry: impl_->componentTypeNames) {
+        lua_pushinteger(lua, (lua_Integer)componentTypeNamesEntry.second);
+        lua_setfield(lua, -2, componentTypeNamesEntry.first.c_str());
+    }
+    lua_setfield(lua, -2, "T");
+    lua_pop(lua, 1);
 }
 
 void Components::PushLua(lua_State* lua) {
@@ -867,64 +2377,148 @@ void Components::PushLua(lua_State* lua) {
 }
 
 auto Components::GetComponentsOfType(Type type) -> ComponentList {
-    return impl_->componentTypes[type].list();
+    return impl_->componentTypes[(size_t)type].list();
+}
+
+auto Components::GetComponentColumns(Type type) -> ComponentColumns {
+    return impl_->componentTypes[(size_t)type].columns();
+}
+
+void Components::MarkChanged(Type type, EntityId entityId) {
+    impl_->componentTypes[(size_t)type].markChanged(entityId);
+}
+
+void Components::ResetChanged() {
+    for (auto& componentType: impl_->componentTypes) {
+        componentType.changes->Reset();
+        componentType.moves->Reset();
+    }
+#ifndef NDEBUG
+    for (size_t type = 0; type < impl_->componentTypes.size(); ++type) {
+        if (!impl_->componentTypes[type].columnsMatch()) {
+            impl_->diagnosticsSender->SendDiagnosticInformationFormatted(
+                SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                "Columns of component type %zu no longer match the components",
+                type
+            );
+        }
+    }
+#endif /* NDEBUG */
+}
+
+auto Components::GetChangedEntityIds(Type type) -> const std::vector< EntityId >& {
+    return impl_->componentTypes[(size_t)type].changes->entityIds;
+}
+
+Component* Components::CreateComponentOfType(Type type, EntityId entityId) {
+    return impl_->componentTypes[(size_t)type].create(entityId);
 }
 
-Component* Components::CreateComponentOfType(Type type, int entityId) {
-    return impl_->componentTypes[type].create(entityId);
+Component* Components::GetEntityComponentOfType(Type type, EntityId entityId) {
+    return impl_->componentTypes[(size_t)type].get(entityId);
 }
 
-Component* Components::GetEntityComponentOfType(Type type, int entityId) {
-    return impl_->componentTypes[type].get(entityId);
+EntityId Components::CreateEntity() {
+    return impl_->CreateEntity();
 }
 
-int Components::CreateEntity() {
-    return impl_->nextEntityId++;
+bool Components::IsEntityAlive(EntityId entityId) {
+    return impl_->IsEntityAlive(entityId);
 }
 
-void Components::KillEntity(int entityId) {
-    for (const auto& componentType: impl_->componentTypes) {
-        componentType.second.kill(entityId);
+void Components::KillEntity(EntityId entityId) {
+    impl_->KillEntity(entityId);
+}
+
+void Components::DestroyEntityComponentOfType(Type type, EntityId entityId) {
+    impl_->componentTypes[(size_t)type].destroy(entityId);
+}
+
+void Components::SetPosition(EntityId entityId, int x, int y) {
+    const auto position = (Position*)GetEntityComponentOfType(Type::Position, entityId);
+    if (position != nullptr) {
+        impl_->MovePosition(*position, x, y);
+        MarkChanged(Type::Position, entityId);
     }
 }
 
-void Components::DestroyEntityComponentOfType(Type type, int entityId) {
-    impl_->componentTypes[type].destroy(entityId);
+void Components::SetColliderMask(EntityId entityId, int mask) {
+    const auto collider = (Collider*)GetEntityComponentOfType(Type::Collider, entityId);
+    if (collider != nullptr) {
+        collider->mask = mask;
+        MarkChanged(Type::Collider, entityId);
+    }
 }
 
-bool Components::IsObstacleInTheWay(int x, int y, int mask) {
-    const auto collidersInfo = GetComponentsOfType(Type::Collider);
-    for (size_t i = 0; i < collidersInfo.n; ++i) {
-        const auto& collider = ((Collider*)collidersInfo.first)[i];
-        const auto position = (Position*)GetEntityComponentOfType(Components::Type::Position, collider.entityId);
-        if (position == nullptr) {
-            continue;
-        }
-        if (
-            (position->x == x)
-            && (position->y == y)
-            && ((mask & collider.mask) != 0)
-        ) {
-            return true;
-        }
+void Components::SetHealth(EntityId entityId, int hp) {
+    const auto health = (Health*)GetEntityComponentOfType(Type::Health, entityId);
+    if (health != nullptr) {
+        health->hp = hp;
+        MarkChanged(Type::Health, entityId);
+    }
+}
+
+void Components::SetWeaponMotion(EntityId entityId, int dx, int dy) {
+    const auto weapon = (Weapon*)GetEntityComponentOfType(Type::Weapon, entityId);
+    if (weapon != nullptr) {
+        weapon->dx = dx;
+        weapon->dy = dy;
+        MarkChanged(Type::Weapon, entityId);
     }
-    return false;
+}
+
+std::vector< EntityId > Components::FindWithinRadius(Type type, int x, int y, int r) {
+    return impl_->FindWithinRadius(impl_->componentTypes[(size_t)type], x, y, r);
+}
+
+EntityId Components::FindNearest(Type type, int x, int y) {
+    return impl_->FindNearest(impl_->componentTypes[(size_t)type], x, y);
+}
+
+bool Components::IsObstacleInTheWay(int x, int y, int mask) {
+    return impl_->IsObstacleInTheWay(x, y, mask);
 }
 
 Collider* Components::GetColliderAt(int x, int y) {
-    const auto collidersInfo = GetComponentsOfType(Type::Collider);
-    for (size_t i = 0; i < collidersInfo.n; ++i) {
-        auto& collider = ((Collider*)collidersInfo.first)[i];
-        const auto position = (Position*)GetEntityComponentOfType(Components::Type::Position, collider.entityId);
-        if (position == nullptr) {
-            continue;
-        }
-        if (
-            (position->x == x)
-            && (position->y == y)
-        ) {
-            return &collider;
-        }
+    return impl_->GetColliderAt(x, y);
+}
+
+void Components::SetStaticLayerSize(int width, int height) {
+    impl_->staticLayerWidth = std::max(0, width);
+    impl_->staticLayerHeight = std::max(0, height);
+    impl_->staticTiles.assign((size_t)impl_->staticLayerWidth * impl_->staticLayerHeight, 0);
+}
+
+int Components::AddStaticTileKind(const StaticTileKind& kind) {
+    if (impl_->staticTileKinds.size() > UINT8_MAX) {
+        return 0;
+    }
+    impl_->staticTileKinds.push_back(kind);
+    return (int)impl_->staticTileKinds.size() - 1;
+}
+
+void Components::SetStaticTile(int x, int y, int kind) {
+    if (
+        (x < 0)
+        || (y < 0)
+        || (x >= impl_->staticLayerWidth)
+        || (y >= impl_->staticLayerHeight)
+        || (kind < 0)
+        || ((size_t)kind >= impl_->staticTileKinds.size())
+    ) {
+        return;
     }
-    return nullptr;
+    impl_->staticTiles[(size_t)y * impl_->staticLayerWidth + x] = (uint8_t)kind;
+}
+
+auto Components::GetStaticTile(int x, int y) -> const StaticTileKind* {
+    return impl_->GetStaticTile(x, y);
+}
+
+int Components::GetStaticLayerWidth() {
+    return impl_->staticLayerWidth;
+}
+
+int Components::GetStaticLayerHeight() {
+    return impl_->staticLayerHeight;
 }
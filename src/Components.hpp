@@ -1,5 +1,6 @@
 #pragma once
 
+#include "AtomTable.hpp"
 #include "Component.hpp"
 #include "Components/Collider.hpp"
 #include "Components/Generator.hpp"
@@ -14,7 +15,9 @@
 #include "Components/Weapon.hpp"
 
 #include <memory>
+#include <string>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <vector>
 
 extern "C" {
 #include <lua.h>
@@ -39,11 +42,58 @@ public:
         Weapon,
     };
 
-    struct ComponentList {
+    /**
+     * This is a run of components of one type which are contiguous
+     * in memory.
+     */
+    struct ComponentPage {
         Component* first = nullptr;
         size_t n = 0;
     };
 
+    /**
+     * This holds all the components of one type, which are stored in
+     * pages that never move, so that creating components never moves
+     * existing ones.
+     */
+    struct ComponentList {
+        std::vector< ComponentPage > pages;
+        size_t n = 0;
+    };
+
+    /**
+     * This gives access to the columns in which copies of some of the
+     * fields of all components of one type are kept, for scans which
+     * only need those fields.  The columns of each type are:
+     * - Collider: mask
+     * - Health: hp
+     * - Position: x, y
+     * - Weapon: dx, dy
+     *
+     * Other types have no columns.  Creating or destroying components
+     * of the type invalidates the pointers.  The columned fields can
+     * only be written through Lua or the setters of this class, which
+     * keep the columns up to date.
+     */
+    struct ComponentColumns {
+        const EntityId* entityIds = nullptr;
+        std::vector< const int* > fields;
+        size_t n = 0;
+    };
+
+    /**
+     * This describes one kind of tile in the static layer, which holds
+     * the parts of the level that never move, such as floors and walls.
+     */
+    struct StaticTileKind {
+        /**
+         * This is the atom of the name of the texture of the tile.
+         */
+        int name = 0;
+        int z = 0;
+        int mask = 0;
+    };
+
     // Lifecycle Methods
 public:
     ~Components() noexcept;
@@ -63,6 +113,15 @@ public:
         std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender
     );
 
+    /**
+     * Set the table of names to which components refer by atom.
+     * This must be done before building the component type map.
+     *
+     * @param[in] atoms
+     *     This is the table of names to use.
+     */
+    void SetAtomTable(std::shared_ptr< AtomTable > atoms);
+
     /**
      * Link the class with the given Lua interpreter.
      *
@@ -89,11 +148,201 @@ public:
     void PushLua(lua_State* lua);
 
     ComponentList GetComponentsOfType(Type type);
-    Component* CreateComponentOfType(Type type, int entityId);
-    Component* GetEntityComponentOfType(Type type, int entityId);
-    int CreateEntity();
-    void KillEntity(int entityId);
-    void DestroyEntityComponentOfType(Type type, int entityId);
+    ComponentColumns GetComponentColumns(Type type);
+
+    /**
+     * Record that the given entity's component of the given type has
+     * changed.  Writes made through Lua or the setters of this class are
+     * recorded automatically, but native code which writes other fields
+     * directly must call this afterwards.
+     *
+     * @param[in] type
+     *     This is the type of the component which was written.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity whose component was written.
+     */
+    void MarkChanged(Type type, EntityId entityId);
+
+    /**
+     * Forget which components have changed.  This is done once per tick,
+     * after the systems have run.  In debug builds, this also checks that
+     * the columns of each type still match its components.
+     */
+    void ResetChanged();
+
+    /**
+     * Return the IDs of the entities whose components of the given type
+     * have changed since the changes were last reset, in the order in
+     * which they first changed.  Some of these entities may no longer
+     * have a component of the type.
+     *
+     * @param[in] type
+     *     This is the type of components whose changes should be returned.
+     *
+     * @return
+     *     The IDs of the entities whose components of the given type have
+     *     changed are returned.  They stay valid until the next change or
+     *     reset.
+     */
+    const std::vector< EntityId >& GetChangedEntityIds(Type type);
+
+    Component* CreateComponentOfType(Type type, EntityId entityId);
+    Component* GetEntityComponentOfType(Type type, EntityId entityId);
+    EntityId CreateEntity();
+    bool IsEntityAlive(EntityId entityId);
+    void KillEntity(EntityId entityId);
+    void DestroyEntityComponentOfType(Type type, EntityId entityId);
+
+    /**
+     * Move the position of the given entity, keeping the spatial index
+     * of colliders up to date.  Native code must move positions this way
+     * rather than writing the coordinates directly.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity to move.
+     *
+     * @param[in] x
+     *     This is the new horizontal coordinate of the entity.
+     *
+     * @param[in] y
+     *     This is the new vertical coordinate of the entity.
+     */
+    void SetPosition(EntityId entityId, int x, int y);
+
+    /**
+     * Set the mask of the collider of the given entity.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity whose collider should be changed.
+     *
+     * @param[in] mask
+     *     This is the new mask of the collider.
+     */
+    void SetColliderMask(EntityId entityId, int mask);
+
+    /**
+     * Set the hit points of the health of the given entity.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity whose health should be changed.
+     *
+     * @param[in] hp
+     *     This is the new number of hit points.
+     */
+    void SetHealth(EntityId entityId, int hp);
+
+    /**
+     * Set the direction in which the weapon of the given entity moves.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity whose weapon should be changed.
+     *
+     * @param[in] dx
+     *     This is the new horizontal motion of the weapon.
+     *
+     * @param[in] dy
+     *     This is the new vertical motion of the weapon.
+     */
+    void SetWeaponMotion(EntityId entityId, int dx, int dy);
+
+    /**
+     * Clear the static layer and set its dimensions.
+     *
+     * @param[in] width
+     *     This is the number of columns in the static layer.
+     *
+     * @param[in] height
+     *     This is the number of rows in the static layer.
+     */
+    void SetStaticLayerSize(int width, int height);
+
+    /**
+     * Add a kind of tile which can be placed in the static layer.
+     *
+     * @param[in] kind
+     *     This describes the kind of tile to add.
+     *
+     * @return
+     *     The number identifying the kind of tile for SetStaticTile
+     *     is returned, or zero if there are already 255 kinds.
+     */
+    int AddStaticTileKind(const StaticTileKind& kind);
+
+    /**
+     * Place a tile in the static layer, replacing any tile already there.
+     *
+     * @param[in] x
+     *     This is the column of the tile.
+     *
+     * @param[in] y
+     *     This is the row of the tile.
+     *
+     * @param[in] kind
+     *     This is the number returned by AddStaticTileKind for the kind
+     *     of tile to place, or zero to leave the cell empty.
+     */
+    void SetStaticTile(int x, int y, int kind);
+
+    /**
+     * Return the kind of tile in the static layer at the given cell.
+     *
+     * @param[in] x
+     *     This is the column of the tile.
+     *
+     * @param[in] y
+     *     This is the row of the tile.
+     *
+     * @return
+     *     The kind of tile at the given cell is returned, or nullptr
+     *     if the cell is empty or outside the static layer.
+     */
+    const StaticTileKind* GetStaticTile(int x, int y);
+
+    int GetStaticLayerWidth();
+    int GetStaticLayerHeight();
+
+
+    /**
+     * Find the entities which have a component of the given type and
+     * a position no farther than the given radius from the given point.
+     *
+     * @param[in] type
+     *     This is the type of component the entities must have.
+     *
+     * @param[in] x
+     *     This is the horizontal coordinate of the point.
+     *
+     * @param[in] y
+     *     This is the vertical coordinate of the point.
+     *
+     * @param[in] r
+     *     This is the radius.
+     *
+     * @return
+     *     The IDs of the entities found are returned.
+     */
+    std::vector< EntityId > FindWithinRadius(Type type, int x, int y, int r);
+
+    /**
+     * Find the entity which has a component of the given type and
+     * a position nearest the given point.
+     *
+     * @param[in] type
+     *     This is the type of component the entity must have.
+     *
+     * @param[in] x
+     *     This is the horizontal coordinate of the point.
+     *
+     * @param[in] y
+     *     This is the vertical coordinate of the point.
+     *
+     * @return
+     *     The ID of the entity found is returned, or zero if no entity
+     *     has both a component of the given type and a position.
+     */
+    EntityId FindNearest(Type type, int x, int y);
+
     bool IsObstacleInTheWay(int x, int y, int mask);
     Collider* GetColliderAt(int x, int y);
 
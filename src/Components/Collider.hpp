@@ -5,6 +5,16 @@
 #include <string>
 #include <WebSockets/WebSocket.hpp>
 
+class Components;
+
+/**
+ * The mask of a collider is also kept in a column of Components, so only
+ * Components may write it, through Components::SetColliderMask.
+ */
 struct Collider : public Component {
+    int GetMask() const { return mask; }
+
+private:
+    friend class Components;
     int mask = 0;
 };
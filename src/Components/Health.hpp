@@ -5,6 +5,16 @@
 #include <string>
 #include <WebSockets/WebSocket.hpp>
 
+class Components;
+
+/**
+ * The hp of a health is also kept in a column of Components, so only
+ * Components may write it, through Components::SetHealth.
+ */
 struct Health : public Component {
+    int GetHp() const { return hp; }
+
+private:
+    friend class Components;
     int hp = 0;
 };
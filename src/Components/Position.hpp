@@ -2,7 +2,19 @@
 
 #include "../Component.hpp"
 
+class Components;
+
+/**
+ * The coordinates of a position are also kept in columns of Components,
+ * and in its spatial index of colliders, so only Components may write
+ * them, through Components::SetPosition.
+ */
 struct Position : public Component {
+    int GetX() const { return x; }
+    int GetY() const { return y; }
+
+private:
+    friend class Components;
     int x = 0;
     int y = 0;
 };
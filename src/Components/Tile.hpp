@@ -2,13 +2,13 @@
 
 #include "../Component.hpp"
 
-#include <string>
-
 struct Tile : public Component {
-    std::string name;
+    /**
+     * This is the atom of the name of the texture of the tile.
+     */
+    int name = 0;
     int z = 0;
     int phase = 0;
     bool spinning = false;
-    bool dirty = true;
     bool destroyed = false;
 };
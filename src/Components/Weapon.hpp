@@ -4,8 +4,19 @@
 
 #include <string>
 
+class Components;
+
+/**
+ * The motion of a weapon is also kept in columns of Components, so only
+ * Components may write it, through Components::SetWeaponMotion.
+ */
 struct Weapon : public Component {
+    int GetDx() const { return dx; }
+    int GetDy() const { return dy; }
+    EntityId ownerId = 0;
+
+private:
+    friend class Components;
     int dx = 0;
     int dy = 0;
-    int ownerId = 0;
 };
@@ -0,0 +1,262 @@
+/**
+ * @file InputMessage.cpp
+ *
+ * This module contains the implementation of the InputMessage structure.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "InputMessage.hpp"
+
+#include <Json/Value.hpp>
+#include <string.h>
+
+namespace {
+
+    /**
+     * This is a string in a message, given by where its characters are,
+     * without the quotation marks around them.
+     */
+    struct StringView {
+        const char* begin = nullptr;
+        size_t length = 0;
+
+        /**
+         * Return whether or not the string is the given literal.
+         *
+         * @param[in] literal
+         *     This is the literal to which to compare the string.
+         *
+         * @return
+         *     An indication of whether or not the string is the given
+         *     literal is returned.
+         */
+        template< size_t N > bool Is(const char (&literal)[N]) const {
+            return (
+                (length == N - 1)
+                && (memcmp(begin, literal, N - 1) == 0)
+            );
+        }
+    };
+
+    /**
+     * Move past any JSON whitespace at the given position.
+     *
+     * @param[in,out] position
+     *     This is the position in the message.
+     *
+     * @param[in] end
+     *     This is the end of the message.
+     */
+    void SkipWhitespace(const char*& position, const char* end) {
+        while (
+            (position < end)
+            && (
+                (*position == ' ')
+                || (*position == '\t')
+                || (*position == '\n')
+                || (*position == '\r')
+            )
+        ) {
+            ++position;
+        }
+    }
+
+    /**
+     * Read a JSON string at the given position, if it's one which can be
+     * used in place: it has no escapes, and holds only printable ASCII.
+     *
+     * @param[in,out] position
+     *     This is the position in the message.  On success, it's moved
+     *     past the string.
+     *
+     * @param[in] end
+     *     This is the end of the message.
+     *
+     * @param[out] value
+     *     This is where to store the characters of the string.
+     *
+     * @return
+     *     An indication of whether or not a string which can be used
+     *     in place was read is returned.
+     */
+    bool ReadSimpleString(const char*& position, const char* end, StringView& value) {
+        if (
+            (position >= end)
+            || (*position != '"')
+        ) {
+            return false;
+        }
+        const auto begin = ++position;
+        while (position < end) {
+            const auto c = (unsigned char)*position;
+            if (c == '"') {
+                value.begin = begin;
+                value.length = (size_t)(position - begin);
+                ++position;
+                return true;
+            }
+            if (
+                (c == '\\')
+                || (c < 0x20)
+                || (c >= 0x80)
+            ) {
+                return false;
+            }
+            ++position;
+        }
+        return false;
+    }
+
+    /**
+     * Find the "type" and "key" members of a message, if the message is
+     * a JSON object whose members are all strings which can be used in
+     * place, with no member given twice.
+     *
+     * @param[in] encoding
+     *     This is the text of the message.
+     *
+     * @param[out] type
+     *     This is where to store the "type" member of the message, which
+     *     is left alone if the message has no such member.
+     *
+     * @param[out] key
+     *     This is where to store the "key" member of the message, which
+     *     is left alone if the message has no such member.
+     *
+     * @return
+     *     An indication of whether or not the message was in the usual
+     *     form is returned.  If it wasn't, the general JSON parser must
+     *     be used to decode it.
+     */
+    bool ReadSimpleMessage(
+        const std::string& encoding,
+        StringView& type,
+        StringView& key
+    ) {
+        auto position = encoding.data();
+        const auto end = position + encoding.length();
+        SkipWhitespace(position, end);
+        if (
+            (position >= end)
+            || (*position++ != '{')
+        ) {
+            return false;
+        }
+        SkipWhitespace(position, end);
+        if (
+            (position < end)
+            && (*position == '}')
+        ) {
+            ++position;
+        } else {
+            bool haveType = false;
+            bool haveKey = false;
+            for (;;) {
+                StringView name, value;
+                if (!ReadSimpleString(position, end, name)) {
+                    return false;
+                }
+                SkipWhitespace(position, end);
+                if (
+                    (position >= end)
+                    || (*position++ != ':')
+                ) {
+                    return false;
+                }
+                SkipWhitespace(position, end);
+                if (!ReadSimpleString(position, end, value)) {
+                    return false;
+                }
+                if (name.Is("type")) {
+                    if (haveType) {
+                        return false;
+                    }
+                    haveType = true;
+                    type = value;
+                } else if (name.Is("key")) {
+                    if (haveKey) {
+                        return false;
+                    }
+                    haveKey = true;
+                    key = value;
+                }
+                SkipWhitespace(position, end);
+                if (position >= end) {
+                    return false;
+                }
+                const auto separator = *position++;
+                if (separator == '}') {
+                    break;
+                }
+                if (separator != ',') {
+                    return false;
+                }
+                SkipWhitespace(position, end);
+            }
+        }
+        SkipWhitespace(position, end);
+        return (position == end);
+    }
+
+    /**
+     * Decode the given message with the general JSON parser.
+     *
+     * @param[in] encoding
+     *     This is the text of the message.
+     *
+     * @return
+     *     The decoded message is returned.
+     */
+    InputMessage ParseMessage(const std::string& encoding) {
+        InputMessage message;
+        const auto json = Json::Value::FromEncoding(encoding);
+        if (json["type"] == "resync") {
+            message.type = InputMessage::Type::Resync;
+        } else if (json["type"] == "fire") {
+            message.type = InputMessage::Type::Fire;
+        } else if (json["type"] == "move") {
+            message.type = InputMessage::Type::Move;
+        } else if (json["type"] == "potion") {
+            message.type = InputMessage::Type::Potion;
+        }
+        if (
+            (message.type == InputMessage::Type::Fire)
+            || (message.type == InputMessage::Type::Move)
+        ) {
+            const auto keyString = (std::string)json["key"];
+            if (!keyString.empty()) {
+                message.key = keyString[0];
+            }
+        }
+        return message;
+    }
+
+}
+
+InputMessage InputMessage::FromEncoding(const std::string& encoding) {
+    StringView type, key;
+    if (!ReadSimpleMessage(encoding, type, key)) {
+        return ParseMessage(encoding);
+    }
+    InputMessage message;
+    if (type.Is("resync")) {
+        message.type = Type::Resync;
+    } else if (type.Is("fire")) {
+        message.type = Type::Fire;
+    } else if (type.Is("move")) {
+        message.type = Type::Move;
+    } else if (type.Is("potion")) {
+        message.type = Type::Potion;
+    }
+    if (
+        (
+            (message.type == Type::Fire)
+            || (message.type == Type::Move)
+        )
+        && (key.length > 0)
+    ) {
+        message.key = key.begin[0];
+    }
+    return message;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+ * @file InputMessage.hpp
+ *
+ * This module declares the InputMessage structure.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <string>
+
+/**
+ * This is what a game needs to know from a message sent by its client.
+ */
+struct InputMessage {
+    // Types
+
+    /**
+     * These are the kinds of messages a client may send.
+     */
+    enum class Type {
+        /**
+         * The message isn't one the game understands, and is ignored.
+         */
+        Unknown,
+
+        /**
+         * The client wants a keyframe, because it lost track of the
+         * render frames sent to it.
+         */
+        Resync,
+
+        /**
+         * A fire key was pressed or released.
+         */
+        Fire,
+
+        /**
+         * A move key was pressed or released.
+         */
+        Move,
+
+        /**
+         * The player wants to use a potion.
+         */
+        Potion,
+    };
+
+    // Properties
+
+    /**
+     * This is the kind of message.
+     */
+    Type type = Type::Unknown;
+
+    /**
+     * For fire and move messages, this is the first character of the
+     * key pressed, or zero if the key was released.
+     */
+    char key = 0;
+
+    // Methods
+
+    /**
+     * Decode the given message sent by a client.  Messages in the usual
+     * form, a flat JSON object whose members are all strings without
+     * escapes, are decoded in place.  Anything else is decoded with the
+     * general JSON parser.
+     *
+     * @param[in] encoding
+     *     This is the text of the message.
+     *
+     * @return
+     *     The decoded message is returned.
+     */
+    static InputMessage FromEncoding(const std::string& encoding);
+};
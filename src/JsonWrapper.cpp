@@ -8,10 +8,185 @@
 
 #include "JsonWrapper.hpp"
 
+#include <limits.h>
+#include <stddef.h>
+#include <string>
+
 namespace {
 
+    /**
+     * This is what each "json" userdata holds.  It either owns a JSON
+     * value, in which case it's the root of that value, or it's a view
+     * of a value nested somewhere inside the value of its parent, which
+     * is another "json" userdata.  A view keeps its parent alive by
+     * holding it as its uservalue, so reading nested values never copies
+     * them.
+     *
+     * Changing any part of a value may move the values nested in it, so
+     * every change made through the root or any of its views is counted
+     * in the root, and a view finds its value again in its parent the
+     * first time it's used after a change.
+     */
+    struct JsonHandle {
+        /**
+         * This is the handle which owns the whole value.
+         */
+        JsonHandle* root = nullptr;
+
+        /**
+         * For a view, this is the handle of the value containing the
+         * viewed value.
+         */
+        JsonHandle* parent = nullptr;
+
+        /**
+         * This points to the value, if known.  For a view, it's only
+         * known while the generation matches that of the root.
+         */
+        Json::Value* value = nullptr;
+
+        /**
+         * For the root, this counts the changes made to the value.
+         * For a view, this is the generation of the root when the value
+         * was last found.
+         */
+        size_t generation = 0;
+
+        /**
+         * For a view of an element of an array, this indicates that the
+         * index is used, rather than the key.
+         */
+        bool indexed = false;
+
+        /**
+         * For a view of an element of an array, this is the index of the
+         * element in the array.
+         */
+        size_t index = 0;
+
+        /**
+         * For a view of a member of an object, this is the key of the
+         * member.
+         */
+        std::string key;
+
+        /**
+         * For the root, this is the value owned by the handle.
+         */
+        Json::Value owned;
+    };
+
+    /**
+     * Push onto the Lua stack a new "json" userdata which owns the
+     * given value.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     *
+     * @param[in] json
+     *     This is the value for the new userdata to own.
+     *
+     * @return
+     *     The handle held by the new userdata is returned.
+     */
+    JsonHandle* PushRoot(
+        lua_State* lua,
+        Json::Value&& json
+    ) {
+        auto self = (JsonHandle*)lua_newuserdata(lua, sizeof(JsonHandle));
+        new (self) JsonHandle();
+        self->root = self;
+        self->owned = std::move(json);
+        self->value = &self->owned;
+        luaL_setmetatable(lua, "json");
+        return self;
+    }
+
+    /**
+     * Return the value referred to by the given handle, finding it again
+     * in its parent if the value has changed since it was last found.
+     *
+     * @param[in] handle
+     *     This is the handle whose value should be returned.
+     *
+     * @return
+     *     The value referred to by the handle is returned, or nullptr if
+     *     the handle is a view of a value which is no longer there.
+     */
+    Json::Value* Resolve(JsonHandle* handle) {
+        if (
+            (handle->root == handle)
+            || (handle->generation == handle->root->generation)
+        ) {
+            return handle->value;
+        }
+        handle->value = nullptr;
+        handle->generation = handle->root->generation;
+        const auto parentValue = Resolve(handle->parent);
+        if (parentValue == nullptr) {
+            return nullptr;
+        }
+        if (handle->indexed) {
+            if (
+                (parentValue->GetType() == Json::Value::Type::Array)
+                && (handle->index < parentValue->GetSize())
+            ) {
+                handle->value = &(*parentValue)[handle->index];
+            }
+        } else {
+            if (
+                (parentValue->GetType() == Json::Value::Type::Object)
+                && parentValue->Has(handle->key)
+            ) {
+                handle->value = &(*parentValue)[handle->key];
+            }
+        }
+        return handle->value;
+    }
+
+    /**
+     * Return the value of the "json" userdata at the given index on the
+     * Lua stack, raising a Lua error if it's a view of a value which is
+     * no longer there.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     *
+     * @param[in] index
+     *     This is the index of the "json" userdata on the Lua stack.
+     *
+     * @return
+     *     The value of the userdata is returned.
+     */
+    Json::Value* CheckJson(
+        lua_State* lua,
+        int index
+    ) {
+        const auto handle = (JsonHandle*)luaL_checkudata(lua, index, "json");
+        const auto value = Resolve(handle);
+        if (value == nullptr) {
+            (void)luaL_error(lua, "JSON view no longer refers to a value");
+        }
+        return value;
+    }
+
+    /**
+     * This is the deepest a Lua table may be nested in the tables
+     * converted to a JSON value, which also stops tables which contain
+     * themselves from being converted forever.
+     */
+    constexpr int MAX_TABLE_DEPTH = 100;
+
     /**
      * Construct a new Json::Value based on a value on the Lua stack.
+     * A table whose keys are exactly the integers from 1 up to its
+     * length, with at least one element, becomes an array.  Any other
+     * table becomes an object, whose keys must be strings or numbers.
+     *
+     * This never raises a Lua error itself, because the error would
+     * unwind past the values under construction without destroying them.
+     * Instead, the caller raises the error with lua_error, once those
+     * values are gone.
      *
      * @param[in] lua
      *     This points to the Lua interpreter instance.
@@ -19,45 +194,142 @@ namespace {
      * @param[in] index
      *     This is the index of the value on the Lua stack that will be wrapped.
      *
+     * @param[out] json
+     *     This is where to store the newly constructed value.
+     *
+     * @param[in] depth
+     *     This is the number of tables containing the value.
+     *
      * @return
-     *     The newly constructed Json::Value is returned.
+     *     An indication of whether or not the value could be converted is
+     *     returned.  If not, an error message is pushed onto the Lua stack.
      */
-    Json::Value JsonValueFromLuaValue(
+    bool JsonValueFromLuaValue(
         lua_State* lua,
-        int index
+        int index,
+        Json::Value& json,
+        int depth = 0
     ) {
-        luaL_checkany(lua, index);
         switch (lua_type(lua, index)) {
             case LUA_TNIL: {
-                return Json::Value();
+                json = Json::Value();
             } break;
             case LUA_TNUMBER: {
                 if (lua_isinteger(lua, index)) {
-                    return Json::Value((int)lua_tointeger(lua, index));
+                    const auto value = lua_tointeger(lua, index);
+                    if (
+                        (value >= (lua_Integer)INT_MIN)
+                        && (value <= (lua_Integer)INT_MAX)
+                    ) {
+                        json = Json::Value((int)value);
+                    } else {
+                        json = Json::Value((double)value);
+                    }
                 } else {
-                    return Json::Value((double)lua_tonumber(lua, index));
+                    json = Json::Value((double)lua_tonumber(lua, index));
                 }
             } break;
             case LUA_TBOOLEAN: {
-                return Json::Value(lua_toboolean(lua, index) != 0);
+                json = Json::Value(lua_toboolean(lua, index) != 0);
             } break;
             case LUA_TSTRING: {
-                return Json::Value(lua_tostring(lua, index));
+                json = Json::Value(lua_tostring(lua, index));
+            } break;
+            case LUA_TTABLE: {
+                if (depth >= MAX_TABLE_DEPTH) {
+                    lua_pushfstring(lua, "cannot construct a JSON value from tables nested more than %d deep", MAX_TABLE_DEPTH);
+                    return false;
+                }
+                if (!lua_checkstack(lua, 3)) {
+                    lua_pushliteral(lua, "cannot construct a JSON value from a table");
+                    return false;
+                }
+                index = lua_absindex(lua, index);
+                const auto length = (size_t)lua_rawlen(lua, index);
+                size_t numKeys = 0;
+                lua_pushnil(lua);
+                while (lua_next(lua, index) != 0) {
+                    lua_pop(lua, 1);
+                    ++numKeys;
+                }
+                if (
+                    (length > 0)
+                    && (numKeys == length)
+                ) {
+                    json = Json::Value(Json::Value::Type::Array);
+                    for (size_t i = 1; i <= length; ++i) {
+                        Json::Value element;
+                        (void)lua_rawgeti(lua, index, (lua_Integer)i);
+                        if (!JsonValueFromLuaValue(lua, -1, element, depth + 1)) {
+                            return false;
+                        }
+                        lua_pop(lua, 1);
+                        json.Add(std::move(element));
+                    }
+                    break;
+                }
+                json = Json::Value(Json::Value::Type::Object);
+                lua_pushnil(lua);
+                while (lua_next(lua, index) != 0) {
+                    switch (lua_type(lua, -2)) {
+                        case LUA_TSTRING:
+                        case LUA_TNUMBER: {
+                            lua_pushvalue(lua, -2);
+                            const std::string key = lua_tostring(lua, -1);
+                            lua_pop(lua, 1);
+                            if (!JsonValueFromLuaValue(lua, -1, json[key], depth + 1)) {
+                                return false;
+                            }
+                        } break;
+                        default: {
+                            lua_pushfstring(lua, "cannot construct a JSON object with a %s key", lua_typename(lua, lua_type(lua, -2)));
+                            return false;
+                        }
+                    }
+                    lua_pop(lua, 1);
+                }
             } break;
             case LUA_TUSERDATA: {
                 void* udata = luaL_testudata(lua, index, "json");
                 if (udata != nullptr) {
-                    auto json = (Json::Value*)udata;
-                    return *json;
-                } else {
-                    (void)luaL_error(lua, "cannot construct a JSON value from a %s", lua_typename(lua, lua_type(lua, index)));
+                    const auto value = Resolve((JsonHandle*)udata);
+                    json = (value == nullptr) ? Json::Value() : *value;
+                    break;
                 }
             }
             default: {
-                (void)luaL_error(lua, "cannot construct a JSON value from a %s", lua_typename(lua, lua_type(lua, index)));
+                lua_pushfstring(lua, "cannot construct a JSON value from a %s", luaL_typename(lua, index));
+                return false;
             }
         }
-        return Json::Value();
+        return true;
+    }
+
+    /**
+     * Push onto the Lua stack a new "json" userdata which owns a value
+     * constructed from the value at the given index on the Lua stack.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     *
+     * @param[in] index
+     *     This is the index of the value on the Lua stack to convert.
+     *
+     * @return
+     *     An indication of whether or not the value could be converted is
+     *     returned.  If not, an error message is pushed onto the Lua stack
+     *     instead, for the caller to raise with lua_error.
+     */
+    bool PushRootFromLuaValue(
+        lua_State* lua,
+        int index
+    ) {
+        Json::Value json;
+        if (!JsonValueFromLuaValue(lua, index, json)) {
+            return false;
+        }
+        (void)PushRoot(lua, std::move(json));
+        return true;
     }
 
     /**
@@ -69,14 +341,13 @@ namespace {
      */
     int Constructor(lua_State* lua) {
         const int numArgs = (int)lua_gettop(lua);
-        auto self = (Json::Value*)lua_newuserdata(lua, sizeof(Json::Value));
         if (numArgs >= 2) {
-            auto json = JsonValueFromLuaValue(lua, 2);
-            new (self) Json::Value(std::move(json));
+            if (!PushRootFromLuaValue(lua, 2)) {
+                return lua_error(lua);
+            }
         } else {
-            new (self) Json::Value();
+            (void)PushRoot(lua, Json::Value());
         }
-        luaL_setmetatable(lua, "json");
         return 1;
     }
 
@@ -88,12 +359,72 @@ namespace {
      *     This points to the Lua interpreter instance.
      */
     int Add(lua_State* lua) {
-        auto self = (Json::Value*)luaL_checkudata(lua, 1, "json");
-        auto json = JsonValueFromLuaValue(lua, 2);
-        self->Add(json);
+        auto self = CheckJson(lua, 1);
+        luaL_checkany(lua, 2);
+        bool converted;
+        {
+            Json::Value json;
+            converted = JsonValueFromLuaValue(lua, 2, json);
+            if (converted) {
+                self->Add(std::move(json));
+            }
+        }
+        if (!converted) {
+            return lua_error(lua);
+        }
+        ++((JsonHandle*)lua_touserdata(lua, 1))->root->generation;
         return 0;
     }
 
+    /**
+     * This is a Lua function registered as the Object
+     * class method of the "json" class.  It returns a new empty
+     * JSON object.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     */
+    int Object(lua_State* lua) {
+        (void)PushRoot(lua, Json::Value(Json::Value::Type::Object));
+        return 1;
+    }
+
+    /**
+     * This is a Lua function registered as the Array
+     * class method of the "json" class.  It returns a new JSON array
+     * holding the given number of nulls, or no elements if no number
+     * is given.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     */
+    int Array(lua_State* lua) {
+        const auto length = luaL_optinteger(lua, 1, 0);
+        luaL_argcheck(lua, length >= 0, 1, "array length must not be negative");
+        Json::Value json(Json::Value::Type::Array);
+        for (lua_Integer i = 0; i < length; ++i) {
+            json.Add(Json::Value());
+        }
+        (void)PushRoot(lua, std::move(json));
+        return 1;
+    }
+
+    /**
+     * This is a Lua function registered as the FromTable
+     * class method of the "json" class.  It returns a new JSON value
+     * converted from the given table and all the tables nested in it.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     */
+    int FromTable(lua_State* lua) {
+        luaL_checktype(lua, 1, LUA_TTABLE);
+        if (!PushRootFromLuaValue(lua, 1)) {
+            return lua_error(lua);
+        }
+        return 1;
+    }
+
     /**
      * This is a Lua function registered as the Parse
      * class method of the "json" class.
@@ -103,9 +434,7 @@ namespace {
      */
     int Parse(lua_State* lua) {
         const std::string encoding = luaL_checkstring(lua, 1);
-        auto json = (Json::Value*)lua_newuserdata(lua, sizeof(Json::Value));
-        new (json) Json::Value(Json::Value::FromEncoding(encoding));
-        luaL_setmetatable(lua, "json");
+        (void)PushRoot(lua, Json::Value::FromEncoding(encoding));
         return 1;
     }
 
@@ -120,6 +449,12 @@ namespace {
         const std::string fieldName = luaL_checkstring(lua, 2);
         if (fieldName == "Add") {
             lua_pushcfunction(lua, Add);
+        } else if (fieldName == "Array") {
+            lua_pushcfunction(lua, Array);
+        } else if (fieldName == "FromTable") {
+            lua_pushcfunction(lua, FromTable);
+        } else if (fieldName == "Object") {
+            lua_pushcfunction(lua, Object);
         } else if (fieldName == "Parse") {
             lua_pushcfunction(lua, Parse);
         } else {
@@ -136,8 +471,8 @@ namespace {
      *     This points to the Lua interpreter instance.
      */
     int Finalizer(lua_State* lua) {
-        auto self = (Json::Value*)luaL_checkudata(lua, 1, "json");
-        self->~Value();
+        auto self = (JsonHandle*)luaL_checkudata(lua, 1, "json");
+        self->~JsonHandle();
         return 0;
     }
 
@@ -149,15 +484,60 @@ namespace {
      *     This points to the Lua interpreter instance.
      */
     int ObjectIndex(lua_State* lua) {
-        auto self = (Json::Value*)luaL_checkudata(lua, 1, "json");
-        const std::string fieldName = luaL_checkstring(lua, 2);
-        const auto& value = self->operator[](fieldName);
+        const auto handle = (JsonHandle*)luaL_checkudata(lua, 1, "json");
+        const auto self = Resolve(handle);
+        if (self == nullptr) {
+            lua_pushnil(lua);
+            return 1;
+        }
+        Json::Value* valuePointer = nullptr;
+        bool indexed = false;
+        size_t index = 0;
+        const char* fieldName = nullptr;
+        if (
+            (self->GetType() == Json::Value::Type::Array)
+            && lua_isinteger(lua, 2)
+        ) {
+            const auto luaIndex = lua_tointeger(lua, 2);
+            if (
+                (luaIndex >= 1)
+                && ((size_t)luaIndex <= self->GetSize())
+            ) {
+                indexed = true;
+                index = (size_t)(luaIndex - 1);
+                valuePointer = &(*self)[index];
+            }
+        } else {
+            fieldName = luaL_checkstring(lua, 2);
+            if (
+                (self->GetType() == Json::Value::Type::Object)
+                && self->Has(fieldName)
+            ) {
+                valuePointer = &(*self)[fieldName];
+            }
+        }
+        if (valuePointer == nullptr) {
+            lua_pushnil(lua);
+            return 1;
+        }
+        const auto& value = *valuePointer;
         switch (value.GetType()) {
             case Json::Value::Type::Array:
             case Json::Value::Type::Object: {
-                auto returnValue = (Json::Value*)lua_newuserdata(lua, sizeof(Json::Value));
-                new (returnValue) Json::Value(value);
+                auto view = (JsonHandle*)lua_newuserdata(lua, sizeof(JsonHandle));
+                new (view) JsonHandle();
+                view->root = handle->root;
+                view->parent = handle;
+                view->value = valuePointer;
+                view->generation = handle->root->generation;
+                view->indexed = indexed;
+                view->index = index;
+                if (!indexed) {
+                    view->key = fieldName;
+                }
                 luaL_setmetatable(lua, "json");
+                lua_pushvalue(lua, 1);
+                lua_setuservalue(lua, -2);
             } break;
             case Json::Value::Type::Boolean: {
                 lua_pushboolean(lua, (bool)value ? 1 : 0);
@@ -189,10 +569,36 @@ namespace {
      *     This points to the Lua interpreter instance.
      */
     int ObjectNewIndex(lua_State* lua) {
-        auto self = (Json::Value*)luaL_checkudata(lua, 1, "json");
-        const std::string fieldName = luaL_checkstring(lua, 2);
-        auto json = JsonValueFromLuaValue(lua, 3);
-        self->operator[](fieldName) = std::move(json);
+        auto self = CheckJson(lua, 1);
+        bool converted;
+        if (
+            (self->GetType() == Json::Value::Type::Array)
+            && lua_isinteger(lua, 2)
+        ) {
+            const auto luaIndex = lua_tointeger(lua, 2);
+            const auto length = (lua_Integer)self->GetSize();
+            luaL_argcheck(lua, (luaIndex >= 1) && (luaIndex <= length + 1), 2, "array index out of range");
+            Json::Value json;
+            converted = JsonValueFromLuaValue(lua, 3, json);
+            if (converted) {
+                if (luaIndex == length + 1) {
+                    self->Add(std::move(json));
+                } else {
+                    self->operator[]((size_t)(luaIndex - 1)) = std::move(json);
+                }
+            }
+        } else {
+            const auto fieldName = luaL_checkstring(lua, 2);
+            Json::Value json;
+            converted = JsonValueFromLuaValue(lua, 3, json);
+            if (converted) {
+                self->operator[](fieldName) = std::move(json);
+            }
+        }
+        if (!converted) {
+            return lua_error(lua);
+        }
+        ++((JsonHandle*)lua_touserdata(lua, 1))->root->generation;
         return 0;
     }
 
@@ -204,7 +610,7 @@ namespace {
      *     This points to the Lua interpreter instance.
      */
     int ToString(lua_State* lua) {
-        auto self = (Json::Value*)luaL_checkudata(lua, 1, "json");
+        auto self = CheckJson(lua, 1);
         const std::string encoding = self->ToEncoding();
         lua_pushlstring(lua, encoding.c_str(), encoding.length());
         return 1;
@@ -218,7 +624,7 @@ namespace {
      *     This points to the Lua interpreter instance.
      */
     int Len(lua_State* lua) {
-        auto self = (Json::Value*)luaL_checkudata(lua, 1, "json");
+        auto self = CheckJson(lua, 1);
         lua_pushinteger(lua, self->GetSize());
         return 1;
     }
@@ -254,3 +660,19 @@ void JsonWrapper::LinkLua(lua_State* lua) {
     lua_settable(lua, -3);
     lua_pop(lua, 1);
 }
+
+Json::Value* JsonWrapper::PushLua(lua_State* lua, Json::Value&& json) {
+    return PushRoot(lua, std::move(json))->value;
+}
+
+Json::Value* JsonWrapper::CheckLua(lua_State* lua, int index) {
+    return CheckJson(lua, index);
+}
+
+Json::Value* JsonWrapper::TestLua(lua_State* lua, int index) {
+    const auto handle = (JsonHandle*)luaL_testudata(lua, index, "json");
+    if (handle == nullptr) {
+        return nullptr;
+    }
+    return Resolve(handle);
+}
@@ -31,4 +31,55 @@ struct JsonWrapper {
      *     This points to the state of the Lua interpreter.
      */
     static void LinkLua(lua_State* lua);
+
+    /**
+     * Push a Lua wrapper for the given JSON value onto the Lua stack.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] json
+     *     This is the JSON value to wrap.
+     *
+     * @return
+     *     The value held by the wrapper is returned.  It stays valid
+     *     for as long as the wrapper is alive in the interpreter.
+     */
+    static Json::Value* PushLua(lua_State* lua, Json::Value&& json);
+
+    /**
+     * Return the JSON value wrapped by the value at the given index on
+     * the Lua stack, raising a Lua error if it isn't a JSON value.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] index
+     *     This is the index of the wrapper on the Lua stack.
+     *
+     * @return
+     *     The wrapped JSON value is returned.  It may be nested inside
+     *     another value, so it should not be kept once the value or any
+     *     value containing it is changed.
+     */
+    static Json::Value* CheckLua(lua_State* lua, int index);
+
+    /**
+     * Return the JSON value wrapped by the wrapper at the given index
+     * on the Lua stack, without raising a Lua error.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] index
+     *     This is the index of the wrapper on the Lua stack.
+     *
+     * @return
+     *     The wrapped JSON value is returned, or nullptr if the value at
+     *     the given index isn't a wrapper, or is a view which no longer
+     *     refers to a value.  Like the value returned by CheckLua, it
+     *     should not be kept once the value or any value containing it
+     *     is changed.
+     */
+    static Json::Value* TestLua(lua_State* lua, int index);
 };
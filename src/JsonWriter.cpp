@@ -0,0 +1,101 @@
+/**
+ * @file JsonWriter.cpp
+ *
+ * This module contains the implementation of the JsonWriter structure.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "JsonWriter.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void JsonWriter::AppendString(
+    std::string& text,
+    const char* value,
+    size_t length
+) {
+    text += '"';
+    size_t run = 0;
+    for (size_t i = 0; i < length; ++i) {
+        const auto c = value[i];
+        const char* escape = nullptr;
+        switch (c) {
+            case '"': escape = "\\\""; break;
+            case '\\': escape = "\\\\"; break;
+            case '\b': escape = "\\b"; break;
+            case '\f': escape = "\\f"; break;
+            case '\n': escape = "\\n"; break;
+            case '\r': escape = "\\r"; break;
+            case '\t': escape = "\\t"; break;
+            default: {
+                if ((unsigned char)c >= 0x20) {
+                    continue;
+                }
+            } break;
+        }
+        (void)text.append(value + run, i - run);
+        run = i + 1;
+        if (escape == nullptr) {
+            char buffer[7];
+            (void)snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned int)c);
+            text += buffer;
+        } else {
+            text += escape;
+        }
+    }
+    (void)text.append(value + run, length - run);
+    text += '"';
+}
+
+void JsonWriter::AppendString(
+    std::string& text,
+    const std::string& value
+) {
+    AppendString(text, value.data(), value.length());
+}
+
+void JsonWriter::AppendInteger(
+    std::string& text,
+    intmax_t value
+) {
+    char buffer[24];
+    auto digits = buffer + sizeof(buffer);
+    auto magnitude = (uintmax_t)value;
+    if (value < 0) {
+        magnitude = (uintmax_t)0 - magnitude;
+    }
+    do {
+        *--digits = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        *--digits = '-';
+    }
+    (void)text.append(digits, (size_t)(buffer + sizeof(buffer) - digits));
+}
+
+void JsonWriter::AppendNumber(
+    std::string& text,
+    double value
+) {
+    if (!isfinite(value)) {
+        text += "null";
+        return;
+    }
+    if (
+        (value == floor(value))
+        && (fabs(value) < 9007199254740992.0)
+    ) {
+        AppendInteger(text, (intmax_t)value);
+        return;
+    }
+    char buffer[32];
+    (void)snprintf(buffer, sizeof(buffer), "%.15g", value);
+    if (strtod(buffer, nullptr) != value) {
+        (void)snprintf(buffer, sizeof(buffer), "%.17g", value);
+    }
+    text += buffer;
+}
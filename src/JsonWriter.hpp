@@ -0,0 +1,83 @@
+#pragma once
+
+/**
+ * @file JsonWriter.hpp
+ *
+ * This module declares the JsonWriter structure.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <stdint.h>
+#include <string>
+
+/**
+ * This appends the JSON encodings of simple values to text, for code
+ * which writes JSON directly rather than building a Json::Value.
+ */
+struct JsonWriter {
+    // Methods
+
+    /**
+     * Append the JSON encoding of the given string to the given text.
+     *
+     * @param[in,out] text
+     *     This is the text to which to append the encoding.
+     *
+     * @param[in] value
+     *     This points to the characters of the string to encode.
+     *
+     * @param[in] length
+     *     This is the number of characters in the string to encode.
+     */
+    static void AppendString(
+        std::string& text,
+        const char* value,
+        size_t length
+    );
+
+    /**
+     * Append the JSON encoding of the given string to the given text.
+     *
+     * @param[in,out] text
+     *     This is the text to which to append the encoding.
+     *
+     * @param[in] value
+     *     This is the string to encode.
+     */
+    static void AppendString(
+        std::string& text,
+        const std::string& value
+    );
+
+    /**
+     * Append the JSON encoding of the given integer to the given text.
+     *
+     * @param[in,out] text
+     *     This is the text to which to append the encoding.
+     *
+     * @param[in] value
+     *     This is the integer to encode.
+     */
+    static void AppendInteger(
+        std::string& text,
+        intmax_t value
+    );
+
+    /**
+     * Append the JSON encoding of the given number to the given text,
+     * using the fewest digits which still read back as the same number.
+     * Numbers which JSON can't represent, such as infinity, are encoded
+     * as null.
+     *
+     * @param[in,out] text
+     *     This is the text to which to append the encoding.
+     *
+     * @param[in] value
+     *     This is the number to encode.
+     */
+    static void AppendNumber(
+        std::string& text,
+        double value
+    );
+};
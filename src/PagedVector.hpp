@@ -0,0 +1,146 @@
+#pragma once
+
+/**
+ * @file PagedVector.hpp
+ *
+ * This module declares the PagedVector class template.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * This is a sequence container which stores its elements in fixed-size
+ * pages.  Pages are allocated as the container grows and are never moved,
+ * so adding elements never relocates existing ones, and elements are
+ * contiguous within each page.
+ *
+ * @tparam T
+ *     This is the type of element to store.
+ *
+ * @tparam PageSize
+ *     This is the number of elements stored in each page.
+ */
+template< typename T, size_t PageSize = 256 > class PagedVector {
+    // Lifecycle Methods
+public:
+    ~PagedVector() noexcept {
+        while (n > 0) {
+            pop_back();
+        }
+    }
+    PagedVector(const PagedVector&) = delete;
+    PagedVector(PagedVector&&) noexcept = delete;
+    PagedVector& operator=(const PagedVector&) = delete;
+    PagedVector& operator=(PagedVector&&) noexcept = delete;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     */
+    PagedVector() = default;
+
+    size_t size() const {
+        return n;
+    }
+
+    bool empty() const {
+        return (n == 0);
+    }
+
+    T& operator[](size_t index) {
+        return *(T*)&pages[index / PageSize][index % PageSize];
+    }
+
+    const T& operator[](size_t index) const {
+        return *(const T*)&pages[index / PageSize][index % PageSize];
+    }
+
+    T& back() {
+        return (*this)[n - 1];
+    }
+
+    /**
+     * Add a default-constructed element to the end of the container.
+     *
+     * @return
+     *     A reference to the new element is returned.
+     */
+    T& emplace_back() {
+        if (n == pages.size() * PageSize) {
+            pages.emplace_back(new Slot[PageSize]);
+        }
+        const auto element = new (&(*this)[n]) T();
+        ++n;
+        return *element;
+    }
+
+    /**
+     * Destroy the last element of the container.  The page holding it
+     * is kept, to be reused as the container grows again.
+     */
+    void pop_back() {
+        back().~T();
+        --n;
+    }
+
+    /**
+     * Return the number of pages which hold elements.
+     *
+     * @return
+     *     The number of pages which hold elements is returned.
+     */
+    size_t GetNumPages() const {
+        return (n + PageSize - 1) / PageSize;
+    }
+
+    /**
+     * Return the first element of the given page.
+     *
+     * @param[in] page
+     *     This is the index of the page.
+     *
+     * @return
+     *     A pointer to the first element of the given page is returned.
+     */
+    T* GetPage(size_t page) {
+        return (T*)&pages[page][0];
+    }
+
+    /**
+     * Return the number of elements in the given page.
+     *
+     * @param[in] page
+     *     This is the index of the page.
+     *
+     * @return
+     *     The number of elements in the given page is returned.
+     */
+    size_t GetPageSize(size_t page) const {
+        const auto start = page * PageSize;
+        return (n - start < PageSize) ? (n - start) : PageSize;
+    }
+
+    // Private properties
+private:
+    /**
+     * This is the type of uninitialized storage for one element.
+     */
+    typedef typename std::aligned_storage< sizeof(T), alignof(T) >::type Slot;
+
+    /**
+     * These are the pages holding the elements.
+     */
+    std::vector< std::unique_ptr< Slot[] > > pages;
+
+    /**
+     * This is the number of elements in the container.
+     */
+    size_t n = 0;
+};
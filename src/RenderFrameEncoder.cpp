@@ -0,0 +1,320 @@
+/**
+ * @file RenderFrameEncoder.cpp
+ *
+ * This module contains the implementations of the RenderFrameEncoder class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "JsonWriter.hpp"
+#include "RenderFrameEncoder.hpp"
+
+#include <algorithm>
+
+namespace {
+
+    /**
+     * This is the frame type of render frames in the binary format.
+     */
+    constexpr uint8_t BINARY_FRAME_TYPE_RENDER = 1;
+
+    /**
+     * These are the flags of a render frame in the binary format.
+     */
+    constexpr uint8_t BINARY_FRAME_KEYFRAME = 1;
+
+    /**
+     * These are the flags of a sprite record in the binary format.
+     */
+    constexpr uint8_t BINARY_SPRITE_SPINNING = 1;
+    constexpr uint8_t BINARY_SPRITE_DESTROYED = 2;
+    constexpr uint8_t BINARY_SPRITE_MOVING = 4;
+
+    /**
+     * Append the given unsigned integer to the given data, in
+     * little-endian order.
+     *
+     * @param[in,out] data
+     *     This is the data to which to append the integer.
+     *
+     * @param[in] value
+     *     This is the integer to append.
+     *
+     * @param[in] size
+     *     This is the number of bytes of the integer to append.
+     */
+    void AppendLittleEndian(std::string& data, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            data += (char)(uint8_t)(value >> (i * 8));
+        }
+    }
+
+}
+
+/**
+ * This contains the private properties of a RenderFrameEncoder class
+ * instance.
+ */
+struct RenderFrameEncoder::Impl {
+    /**
+     * This is the format in which render frames are encoded.
+     */
+    Format format = Format::Json;
+
+    /**
+     * This is the table holding the names of the texture atoms.
+     */
+    std::shared_ptr< AtomTable > atoms;
+
+    /**
+     * This caches, for each atom, its name in the atom table, or nullptr
+     * if the name hasn't been looked up yet.  The atom table is shared
+     * by all games and locks on every lookup, so each name is only looked
+     * up once per encoder.
+     */
+    std::vector< const std::string* > atomNames;
+
+    /**
+     * This indicates, for each atom, whether or not its name has already
+     * been defined for the client in a binary frame.
+     */
+    std::vector< bool > atomsDefined;
+
+    /**
+     * These are the atoms whose names are defined by the binary frame
+     * being encoded.  They are kept between frames only to reuse their
+     * storage.
+     */
+    std::vector< int > atomsToDefine;
+
+    /**
+     * Return the name of the given atom, looking it up in the atom table
+     * only the first time.
+     *
+     * @param[in] atom
+     *     This is the atom whose name should be returned.
+     *
+     * @return
+     *     The name of the given atom is returned.
+     */
+    const std::string& GetAtomName(int atom) {
+        if (atom < 0) {
+            return atoms->GetName(atom);
+        }
+        if ((size_t)atom >= atomNames.size()) {
+            atomNames.resize((size_t)atom + 1);
+        }
+        auto& name = atomNames[atom];
+        if (name == nullptr) {
+            name = &atoms->GetName(atom);
+        }
+        return *name;
+    }
+
+    /**
+     * Encode a render frame as JSON text.
+     *
+     * @param[in] sprites
+     *     These are the sprites to put in the frame.
+     *
+     * @param[in] fields
+     *     This is a JSON object whose members are custom fields to put
+     *     in the frame.
+     *
+     * @param[in] sequence
+     *     This is the sequence number of the frame.
+     *
+     * @param[in] keyframe
+     *     This indicates whether or not the frame is a keyframe.
+     *
+     * @param[out] frame
+     *     This is where to store the encoding of the frame.
+     *
+     * @return
+     *     The length of the part of the frame up to and including its
+     *     sequence number is returned.
+     */
+    size_t EncodeJson(
+        const std::vector< RenderSprite >& sprites,
+        const Json::Value& fields,
+        size_t sequence,
+        bool keyframe,
+        std::string& frame
+    ) {
+        frame = "{\"type\":\"render\",\"seq\":";
+        JsonWriter::AppendInteger(frame, (intmax_t)sequence);
+        const auto sequenceEnd = frame.length();
+        frame += ",\"keyframe\":";
+        frame += (keyframe ? "true" : "false");
+        frame += ",\"sprites\":[";
+        bool firstSprite = true;
+        for (const auto& sprite: sprites) {
+            if (!firstSprite) {
+                frame += ',';
+            }
+            firstSprite = false;
+            frame += "{\"id\":";
+            JsonWriter::AppendInteger(frame, sprite.id);
+            if (sprite.destroyed) {
+                frame += ",\"destroyed\":true}";
+                continue;
+            }
+            frame += ",\"texture\":";
+            JsonWriter::AppendString(frame, GetAtomName(sprite.texture));
+            frame += ",\"x\":";
+            JsonWriter::AppendInteger(frame, sprite.x);
+            frame += ",\"y\":";
+            JsonWriter::AppendInteger(frame, sprite.y);
+            frame += ",\"z\":";
+            JsonWriter::AppendInteger(frame, sprite.z);
+            frame += ",\"phase\":";
+            JsonWriter::AppendInteger(frame, sprite.phase);
+            frame += ",\"spinning\":";
+            frame += (sprite.spinning ? "true" : "false");
+            if (sprite.moving) {
+                frame += ",\"motion\":{\"dx\":";
+                JsonWriter::AppendInteger(frame, sprite.dx);
+                frame += ",\"dy\":";
+                JsonWriter::AppendInteger(frame, sprite.dy);
+                frame += '}';
+            }
+            frame += '}';
+        }
+        frame += ']';
+        for (const auto& key: fields.GetKeys()) {
+            frame += ',';
+            JsonWriter::AppendString(frame, key);
+            frame += ':';
+            frame += fields[key].ToEncoding();
+        }
+        frame += '}';
+        return sequenceEnd;
+    }
+
+    /**
+     * Encode a render frame in the binary format.
+     *
+     * @param[in] sprites
+     *     These are the sprites to put in the frame.
+     *
+     * @param[in] fields
+     *     This is a JSON object whose members are custom fields to put
+     *     in the frame.
+     *
+     * @param[in] sequence
+     *     This is the sequence number of the frame.
+     *
+     * @param[in] keyframe
+     *     This indicates whether or not the frame is a keyframe.
+     *
+     * @param[out] frame
+     *     This is where to store the encoding of the frame.
+     *
+     * @return
+     *     The length of the part of the frame up to and including its
+     *     sequence number is returned.
+     */
+    size_t EncodeBinary(
+        const std::vector< RenderSprite >& sprites,
+        const Json::Value& fields,
+        size_t sequence,
+        bool keyframe,
+        std::string& frame
+    ) {
+        atomsToDefine.clear();
+        if (keyframe) {
+            atomsDefined.clear();
+        }
+        for (const auto& sprite: sprites) {
+            if (sprite.destroyed) {
+                continue;
+            }
+            const auto atom = (size_t)sprite.texture;
+            if (atom >= atomsDefined.size()) {
+                atomsDefined.resize(atom + 1);
+            }
+            if (!atomsDefined[atom]) {
+                atomsDefined[atom] = true;
+                atomsToDefine.push_back(sprite.texture);
+            }
+        }
+        frame.clear();
+        AppendLittleEndian(frame, BINARY_FRAME_TYPE_RENDER, 1);
+        AppendLittleEndian(frame, sequence, 4);
+        const auto sequenceEnd = frame.length();
+        AppendLittleEndian(frame, (keyframe ? BINARY_FRAME_KEYFRAME : 0), 1);
+        AppendLittleEndian(frame, atomsToDefine.size(), 2);
+        for (const auto atom: atomsToDefine) {
+            const auto& name = GetAtomName(atom);
+            const auto length = std::min(name.length(), (size_t)255);
+            AppendLittleEndian(frame, (uint64_t)atom, 2);
+            AppendLittleEndian(frame, length, 1);
+            frame.append(name, 0, length);
+        }
+        AppendLittleEndian(frame, sprites.size(), 4);
+        for (const auto& sprite: sprites) {
+            uint8_t flags = 0;
+            if (sprite.spinning) {
+                flags |= BINARY_SPRITE_SPINNING;
+            }
+            if (sprite.destroyed) {
+                flags |= BINARY_SPRITE_DESTROYED;
+            }
+            if (sprite.moving) {
+                flags |= BINARY_SPRITE_MOVING;
+            }
+            AppendLittleEndian(frame, (uint64_t)sprite.id, 8);
+            AppendLittleEndian(frame, (uint64_t)sprite.texture, 2);
+            AppendLittleEndian(frame, (uint64_t)sprite.x, 2);
+            AppendLittleEndian(frame, (uint64_t)sprite.y, 2);
+            AppendLittleEndian(frame, (uint64_t)sprite.z, 1);
+            AppendLittleEndian(frame, (uint64_t)sprite.phase, 1);
+            AppendLittleEndian(frame, flags, 1);
+            AppendLittleEndian(frame, (uint64_t)sprite.dx, 1);
+            AppendLittleEndian(frame, (uint64_t)sprite.dy, 1);
+            AppendLittleEndian(frame, 0, 1);
+        }
+        if (!fields.GetKeys().empty()) {
+            frame += fields.ToEncoding();
+        }
+        return sequenceEnd;
+    }
+};
+
+const char* const RenderFrameEncoder::BinarySubprotocol = "ironglove.binary.v1";
+const char* const RenderFrameEncoder::JsonSubprotocol = "ironglove.json.v1";
+
+RenderFrameEncoder::~RenderFrameEncoder() noexcept = default;
+
+RenderFrameEncoder::RenderFrameEncoder(
+    Format format,
+    std::shared_ptr< AtomTable > atoms
+)
+    : impl_(new Impl())
+{
+    impl_->format = format;
+    impl_->atoms = atoms;
+}
+
+auto RenderFrameEncoder::GetFormat() const -> Format {
+    return impl_->format;
+}
+
+size_t RenderFrameEncoder::Encode(
+    const std::vector< RenderSprite >& sprites,
+    const Json::Value& fields,
+    size_t sequence,
+    bool keyframe,
+    std::string& frame
+) {
+    switch (impl_->format) {
+        case Format::Binary: {
+            return impl_->EncodeBinary(sprites, fields, sequence, keyframe, frame);
+        }
+
+        case Format::Json:
+        default: {
+            return impl_->EncodeJson(sprites, fields, sequence, keyframe, frame);
+        }
+    }
+}
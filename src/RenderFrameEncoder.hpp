@@ -0,0 +1,169 @@
+#pragma once
+
+/**
+ * @file RenderFrameEncoder.hpp
+ *
+ * This module declares the RenderFrameEncoder class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "AtomTable.hpp"
+
+#include <Json/Value.hpp>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * This is what a render frame tells the client to draw for one entity
+ * or static tile.
+ */
+struct RenderSprite {
+    int64_t id = 0;
+    int texture = 0;
+    int x = 0;
+    int y = 0;
+    int z = 0;
+    int phase = 0;
+    bool spinning = false;
+    bool destroyed = false;
+    bool moving = false;
+    int dx = 0;
+    int dy = 0;
+};
+
+/**
+ * This encodes the render frames sent to one client, either as JSON
+ * text or, for clients which negotiate the binary subprotocol, in the
+ * following binary format, with all integers little-endian:
+ *
+ * - uint8: frame type, which is 1 for a render frame
+ * - uint32: sequence number of the frame
+ * - uint8: frame flags (1 = keyframe)
+ * - uint16: number of texture names defined by the frame
+ * - for each texture name defined: uint16 atom, uint8 length, and the
+ *   bytes of the name.  Each name is defined in the first frame which
+ *   uses it, and again in every keyframe which uses it.
+ * - uint32: number of sprites
+ * - for each sprite, a fixed-width record of 20 bytes:
+ *   int64 id, uint16 texture atom, int16 x, int16 y, int8 z, uint8 phase,
+ *   uint8 flags (1 = spinning, 2 = destroyed, 4 = moving), int8 dx,
+ *   int8 dy, and one reserved byte which is zero.
+ * - the remaining bytes, if any, hold the JSON encoding of an object
+ *   whose members are the custom fields of the frame.
+ *
+ * In JSON, the sequence number and keyframe flag are the "seq" and
+ * "keyframe" members of the frame.
+ *
+ * Frames are numbered in sequence.  A keyframe holds every sprite the
+ * client should draw, replacing any it drew before, while any other
+ * frame holds only the sprites which changed since the frame before.
+ */
+class RenderFrameEncoder {
+    // Types
+public:
+    /**
+     * These are the formats in which render frames can be encoded.
+     */
+    enum class Format {
+        Json,
+        Binary,
+    };
+
+    // Lifecycle Methods
+public:
+    ~RenderFrameEncoder() noexcept;
+    RenderFrameEncoder(const RenderFrameEncoder&) = delete;
+    RenderFrameEncoder(RenderFrameEncoder&&) noexcept = delete;
+    RenderFrameEncoder& operator=(const RenderFrameEncoder&) = delete;
+    RenderFrameEncoder& operator=(RenderFrameEncoder&&) noexcept = delete;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     *
+     * @param[in] format
+     *     This is the format in which to encode render frames.
+     *
+     * @param[in] atoms
+     *     This is the table holding the names of the texture atoms.
+     */
+    RenderFrameEncoder(
+        Format format,
+        std::shared_ptr< AtomTable > atoms
+    );
+
+    /**
+     * Return the format in which render frames are encoded.
+     *
+     * @return
+     *     The format in which render frames are encoded is returned.
+     */
+    Format GetFormat() const;
+
+    /**
+     * Encode a render frame.
+     *
+     * @param[in] sprites
+     *     These are the sprites to put in the frame.
+     *
+     * @param[in] fields
+     *     This is a JSON object whose members are custom fields to put
+     *     in the frame.
+     *
+     * @param[in] sequence
+     *     This is the sequence number of the frame.
+     *
+     * @param[in] keyframe
+     *     This indicates whether or not the frame is a keyframe.
+     *
+     * @param[out] frame
+     *     This is where to store the encoding of the frame.  Its storage
+     *     is reused.
+     *
+     * @return
+     *     The length of the part of the frame up to and including its
+     *     sequence number is returned.  The rest of the frame depends
+     *     only on its contents, so two frames with the same contents
+     *     differ only in this part.
+     */
+    size_t Encode(
+        const std::vector< RenderSprite >& sprites,
+        const Json::Value& fields,
+        size_t sequence,
+        bool keyframe,
+        std::string& frame
+    );
+
+    // Public Properties
+public:
+    /**
+     * This is the WebSocket subprotocol which clients request in order
+     * to be sent render frames in the binary format.
+     */
+    static const char* const BinarySubprotocol;
+
+    /**
+     * This is the WebSocket subprotocol which clients may request in
+     * order to be sent render frames as JSON text, which is also what
+     * clients requesting no subprotocol are sent.
+     */
+    static const char* const JsonSubprotocol;
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+/**
+ * @file SpscRing.hpp
+ *
+ * This module declares the SpscRing class template.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+ * This is a fixed-size queue which one thread (the producer) adds
+ * elements to while another thread (the consumer) removes them, without
+ * either thread ever waiting on a lock.  Only one thread may push and
+ * only one thread may pop.
+ *
+ * @tparam T
+ *     This is the type of element to store.  It is copied in and out of
+ *     the queue, so it should be small.
+ *
+ * @tparam Capacity
+ *     This is the most elements the queue can hold.  It must be a power
+ *     of two.
+ */
+template< typename T, size_t Capacity > class SpscRing {
+    static_assert(
+        (Capacity > 0) && ((Capacity & (Capacity - 1)) == 0),
+        "SpscRing capacity must be a power of two"
+    );
+
+    // Lifecycle Methods
+public:
+    ~SpscRing() noexcept = default;
+    SpscRing(const SpscRing&) = delete;
+    SpscRing(SpscRing&&) noexcept = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+    SpscRing& operator=(SpscRing&&) noexcept = delete;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     */
+    SpscRing() = default;
+
+    /**
+     * Add an element to the end of the queue.  Only the producer
+     * may call this.
+     *
+     * @param[in] value
+     *     This is the element to add.
+     *
+     * @return
+     *     An indication of whether or not the element was added is
+     *     returned.  It isn't added if the queue is full.
+     */
+    bool Push(const T& value) {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        slots_[tail & (Capacity - 1)] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Remove the element at the front of the queue.  Only the consumer
+     * may call this.
+     *
+     * @param[out] value
+     *     This is where to store the element removed.
+     *
+     * @return
+     *     An indication of whether or not an element was removed is
+     *     returned.  None is removed if the queue is empty.
+     */
+    bool Pop(T& value) {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = slots_[head & (Capacity - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Private properties
+private:
+    /**
+     * These hold the elements of the queue.
+     */
+    T slots_[Capacity];
+
+    /**
+     * This counts the elements removed so far.  Only the consumer
+     * changes it.
+     */
+    std::atomic< size_t > head_{0};
+
+    /**
+     * This keeps the head and tail on separate cache lines, so that
+     * the two threads don't contend for the same one.
+     */
+    char padding_[64];
+
+    /**
+     * This counts the elements added so far.  Only the producer
+     * changes it.
+     */
+    std::atomic< size_t > tail_{0};
+};
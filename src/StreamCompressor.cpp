@@ -0,0 +1,318 @@
+/**
+ * @file StreamCompressor.cpp
+ *
+ * This module contains the implementations of the StreamCompressor class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "StreamCompressor.hpp"
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is the farthest back a match may refer, and so how much of
+     * the history of the stream is kept.
+     */
+    constexpr size_t MAX_OFFSET = 65535;
+
+    /**
+     * This is the shortest match the LZ4 block format can express.
+     */
+    constexpr size_t MIN_MATCH = 4;
+
+    /**
+     * These are the limits of the LZ4 block format at the end of a block:
+     * the last match must start at least MATCH_START_LIMIT bytes before
+     * the end, and the last LAST_LITERALS bytes must be literals.
+     */
+    constexpr size_t MATCH_START_LIMIT = 12;
+    constexpr size_t LAST_LITERALS = 5;
+
+    /**
+     * This is the number of bits in the hash of four bytes of data
+     * used to find earlier occurrences of them.
+     */
+    constexpr int HASH_BITS = 14;
+
+    /**
+     * This marks the end of a chain of earlier occurrences.
+     */
+    constexpr uint64_t NO_POSITION = ~(uint64_t)0;
+
+    /**
+     * Return the hash of the four bytes at the given location.
+     *
+     * @param[in] data
+     *     This points to the four bytes to hash.
+     *
+     * @return
+     *     The hash of the four bytes is returned.
+     */
+    size_t Hash(const char* data) {
+        uint32_t value;
+        (void)memcpy(&value, data, sizeof(value));
+        return (size_t)((value * 2654435761u) >> (32 - HASH_BITS));
+    }
+
+    /**
+     * Append to the given block the rest of a length which didn't fit
+     * in the four bits set aside for it in a token.
+     *
+     * @param[in,out] block
+     *     This is the block to which to append the length.
+     *
+     * @param[in] length
+     *     This is the part of the length which didn't fit in the token.
+     */
+    void AppendLength(std::string& block, size_t length) {
+        while (length >= 255) {
+            block += (char)255;
+            length -= 255;
+        }
+        block += (char)length;
+    }
+
+}
+
+/**
+ * This contains the private properties of a StreamCompressor class
+ * instance.
+ */
+struct StreamCompressor::Impl {
+    /**
+     * This is the most earlier occurrences to compare when looking for
+     * the longest match.
+     */
+    size_t maxCandidates = 1;
+
+    /**
+     * This holds the end of the history of the stream, followed by the
+     * message being compressed.
+     */
+    std::string window;
+
+    /**
+     * This is the position in the stream of the first byte in the window.
+     */
+    uint64_t windowStart = 0;
+
+    /**
+     * This is the position in the stream of the first byte which has not
+     * yet been added to the hash chains.
+     */
+    uint64_t hashedEnd = 0;
+
+    /**
+     * This holds, for each hash, the position in the stream of the last
+     * occurrence of four bytes with that hash.
+     */
+    std::vector< uint64_t > heads = std::vector< uint64_t >((size_t)1 << HASH_BITS, NO_POSITION);
+
+    /**
+     * This holds, for each position in the window, the position of the
+     * previous occurrence of four bytes with the same hash.
+     */
+    std::vector< uint64_t > chains = std::vector< uint64_t >(MAX_OFFSET + 1, NO_POSITION);
+
+    /**
+     * Return the byte in the window at the given position in the stream.
+     *
+     * @param[in] position
+     *     This is the position in the stream of the byte to return.
+     *
+     * @return
+     *     A pointer to the byte is returned.
+     */
+    const char* At(uint64_t position) const {
+        return window.data() + (size_t)(position - windowStart);
+    }
+
+    /**
+     * Add to the hash chains all positions before the given one.
+     *
+     * @param[in] end
+     *     This is the position in the stream up to which to add positions.
+     */
+    void HashUpTo(uint64_t end) {
+        while (hashedEnd < end) {
+            const auto hash = Hash(At(hashedEnd));
+            chains[(size_t)(hashedEnd & MAX_OFFSET)] = heads[hash];
+            heads[hash] = hashedEnd;
+            ++hashedEnd;
+        }
+    }
+
+    /**
+     * Drop from the window all history which is too far back for a match
+     * to refer to, and add the given message to the end of the window.
+     *
+     * @param[in] data
+     *     This is the message to add to the window.
+     */
+    void Append(const std::string& data) {
+        if (window.length() > MAX_OFFSET) {
+            const auto drop = window.length() - MAX_OFFSET;
+            (void)window.erase(0, drop);
+            windowStart += drop;
+        }
+        window += data;
+    }
+
+    /**
+     * Find the longest earlier occurrence of the data at the given
+     * position.
+     *
+     * @param[in] position
+     *     This is the position in the stream of the data to match.
+     *
+     * @param[in] end
+     *     This is the position in the stream where the match must end.
+     *
+     * @param[out] matchPosition
+     *     This is where to store the position of the earlier occurrence.
+     *
+     * @return
+     *     The length of the match is returned, or zero if there is no
+     *     match long enough to use.
+     */
+    size_t FindMatch(uint64_t position, uint64_t end, uint64_t& matchPosition) {
+        size_t bestLength = 0;
+        const auto maxLength = (size_t)(end - position);
+        const auto data = At(position);
+        auto candidate = heads[Hash(data)];
+        for (size_t i = 0; i < maxCandidates; ++i) {
+            if (
+                (candidate == NO_POSITION)
+                || (candidate >= position)
+                || (candidate < windowStart)
+                || (position - candidate > MAX_OFFSET)
+            ) {
+                break;
+            }
+            const auto candidateData = At(candidate);
+            size_t length = 0;
+            while (
+                (length < maxLength)
+                && (candidateData[length] == data[length])
+            ) {
+                ++length;
+            }
+            if (length > bestLength) {
+                bestLength = length;
+                matchPosition = candidate;
+                if (length == maxLength) {
+                    break;
+                }
+            }
+            const auto next = chains[(size_t)(candidate & MAX_OFFSET)];
+            if (
+                (next == NO_POSITION)
+                || (next >= candidate)
+            ) {
+                break;
+            }
+            candidate = next;
+        }
+        return (bestLength >= MIN_MATCH) ? bestLength : 0;
+    }
+
+    /**
+     * Append one sequence to the given block: literals, then a match,
+     * unless this is the last sequence of the block.
+     *
+     * @param[in,out] block
+     *     This is the block to which to append the sequence.
+     *
+     * @param[in] literals
+     *     This is the position in the stream of the literals.
+     *
+     * @param[in] numLiterals
+     *     This is the number of literals.
+     *
+     * @param[in] offset
+     *     This is how far back the match refers.
+     *
+     * @param[in] matchLength
+     *     This is the length of the match, or zero for the last sequence.
+     */
+    void AppendSequence(
+        std::string& block,
+        uint64_t literals,
+        size_t numLiterals,
+        size_t offset,
+        size_t matchLength
+    ) {
+        const auto matchCode = (matchLength == 0) ? 0 : matchLength - MIN_MATCH;
+        block += (char)(
+            (std::min(numLiterals, (size_t)15) << 4)
+            | std::min(matchCode, (size_t)15)
+        );
+        if (numLiterals >= 15) {
+            AppendLength(block, numLiterals - 15);
+        }
+        (void)block.append(At(literals), numLiterals);
+        if (matchLength == 0) {
+            return;
+        }
+        block += (char)(offset & 0xFF);
+        block += (char)(offset >> 8);
+        if (matchCode >= 15) {
+            AppendLength(block, matchCode - 15);
+        }
+    }
+};
+
+StreamCompressor::~StreamCompressor() noexcept = default;
+
+StreamCompressor::StreamCompressor(int level)
+    : impl_(new Impl())
+{
+    impl_->maxCandidates = (size_t)1 << (std::min(std::max(level, 1), 9) - 1);
+}
+
+void StreamCompressor::Compress(
+    const std::string& data,
+    std::string& block
+) {
+    impl_->Append(data);
+    const auto end = impl_->windowStart + impl_->window.length();
+    const auto start = end - data.length();
+    auto anchor = start;
+    if (data.length() > MATCH_START_LIMIT) {
+        const auto matchStartLimit = end - MATCH_START_LIMIT;
+        const auto matchEndLimit = end - LAST_LITERALS;
+        auto position = start;
+        while (position < matchStartLimit) {
+            impl_->HashUpTo(position);
+            uint64_t matchPosition;
+            const auto matchLength = impl_->FindMatch(position, matchEndLimit, matchPosition);
+            if (matchLength == 0) {
+                ++position;
+                continue;
+            }
+            impl_->AppendSequence(
+                block,
+                anchor,
+                (size_t)(position - anchor),
+                (size_t)(position - matchPosition),
+                matchLength
+            );
+            position += matchLength;
+            anchor = position;
+        }
+    }
+    impl_->AppendSequence(block, anchor, (size_t)(end - anchor), 0, 0);
+    impl_->HashUpTo((end >= MIN_MATCH) ? end - MIN_MATCH + 1 : 0);
+}
+
+void StreamCompressor::Skip(const std::string& data) {
+    impl_->Append(data);
+    const auto end = impl_->windowStart + impl_->window.length();
+    impl_->HashUpTo((end >= MIN_MATCH) ? end - MIN_MATCH + 1 : 0);
+}
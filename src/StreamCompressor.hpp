@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+ * @file StreamCompressor.hpp
+ *
+ * This module declares the StreamCompressor class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <string>
+
+/**
+ * This compresses a stream of messages sent over one connection.  Each
+ * message is compressed into one block in the LZ4 block format.  Blocks
+ * are linked: a block may refer back to any of the last 64 KiB of data
+ * given to the compressor, including data from earlier messages, so the
+ * receiver must decompress each block with the last 64 KiB of the data
+ * it has decompressed so far as the dictionary.
+ */
+class StreamCompressor {
+    // Lifecycle Methods
+public:
+    ~StreamCompressor() noexcept;
+    StreamCompressor(const StreamCompressor&) = delete;
+    StreamCompressor(StreamCompressor&&) noexcept = delete;
+    StreamCompressor& operator=(const StreamCompressor&) = delete;
+    StreamCompressor& operator=(StreamCompressor&&) noexcept = delete;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     *
+     * @param[in] level
+     *     This is how hard to look for repeated data, from 1 (fastest)
+     *     to 9 (smallest output).
+     */
+    explicit StreamCompressor(int level);
+
+    /**
+     * Compress the given message.
+     *
+     * @param[in] data
+     *     This is the message to compress.
+     *
+     * @param[in,out] block
+     *     This is where to append the compressed block.
+     */
+    void Compress(
+        const std::string& data,
+        std::string& block
+    );
+
+    /**
+     * Add the given message to the history of the stream without
+     * compressing it, for a message which the receiver is given as is.
+     *
+     * @param[in] data
+     *     This is the message to add to the history of the stream.
+     */
+    void Skip(const std::string& data);
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
@@ -1,17 +1,231 @@
 /**
  * @file WebSocketWrapper.cpp
  *
- * This module contains the implementation of the WebSocketWrapper structure.
+ * This module contains the implementation of the WebSocketWrapper class.
  *
  * © 2019 by Richard Walters
  */
 
+#include "JsonWrapper.hpp"
+#include "JsonWriter.hpp"
+#include "StreamCompressor.hpp"
 #include "WebSocketWrapper.hpp"
 
+#include <algorithm>
 #include <Json/Value.hpp>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
 
 namespace {
 
+    /**
+     * These are the flags in the first byte of each message sent when
+     * compression is on.
+     */
+    constexpr char MESSAGE_FLAG_COMPRESSED = 1;
+    constexpr char MESSAGE_FLAG_TEXT = 2;
+
+    /**
+     * Return a hash of the given data, used to tell whether or not a
+     * frame is the same as the one sent before it.  The data is mixed
+     * eight bytes at a time, which is much cheaper than encoding or
+     * sending the frame.
+     *
+     * @param[in] data
+     *     This points to the data to hash.
+     *
+     * @param[in] length
+     *     This is the number of bytes to hash.
+     *
+     * @return
+     *     The hash of the data is returned.
+     */
+    uint64_t Hash(const char* data, size_t length) {
+        uint64_t hash = 0x9E3779B97F4A7C15ull ^ (uint64_t)length;
+        while (length > 0) {
+            uint64_t word = 0;
+            const auto chunk = std::min(length, sizeof(word));
+            (void)memcpy(&word, data, chunk);
+            hash ^= word;
+            hash *= 0xFF51AFD7ED558CCDull;
+            hash ^= (hash >> 32);
+            data += chunk;
+            length -= chunk;
+        }
+        return hash;
+    }
+
+    /**
+     * This is the deepest a Lua table may be nested in a table sent as
+     * JSON, which also stops tables which contain themselves from being
+     * encoded forever.
+     */
+    constexpr int MAX_TABLE_DEPTH = 100;
+
+    bool AppendLuaValue(lua_State* lua, int index, int depth, std::string& text);
+
+    /**
+     * Append the JSON encoding of the Lua table at the given index on the
+     * Lua stack to the given text.  A table whose keys are exactly the
+     * integers from 1 up to its length, with at least one element, is
+     * encoded as an array.  Any other table is encoded as an object,
+     * whose keys must be strings or numbers.
+     *
+     * Like the conversion of tables to JSON values, this never raises
+     * a Lua error itself, so that no error is raised part way through
+     * walking a table.  Instead, the caller raises the error with
+     * lua_error, once the encoding has been abandoned.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     *
+     * @param[in] index
+     *     This is the index of the table on the Lua stack.
+     *
+     * @param[in] depth
+     *     This is the number of tables containing the table.
+     *
+     * @param[in,out] text
+     *     This is the text to which to append the encoding.
+     *
+     * @return
+     *     An indication of whether or not the table could be encoded is
+     *     returned.  If not, an error message is pushed onto the Lua stack.
+     */
+    bool AppendLuaTable(lua_State* lua, int index, int depth, std::string& text) {
+        if (depth >= MAX_TABLE_DEPTH) {
+            lua_pushfstring(lua, "cannot encode tables nested more than %d deep as JSON", MAX_TABLE_DEPTH);
+            return false;
+        }
+        if (!lua_checkstack(lua, 3)) {
+            lua_pushliteral(lua, "cannot encode a table as JSON");
+            return false;
+        }
+        index = lua_absindex(lua, index);
+        const auto length = (size_t)lua_rawlen(lua, index);
+        size_t numKeys = 0;
+        lua_pushnil(lua);
+        while (lua_next(lua, index) != 0) {
+            lua_pop(lua, 1);
+            ++numKeys;
+        }
+        if (
+            (length > 0)
+            && (numKeys == length)
+        ) {
+            text += '[';
+            for (size_t i = 1; i <= length; ++i) {
+                if (i > 1) {
+                    text += ',';
+                }
+                (void)lua_rawgeti(lua, index, (lua_Integer)i);
+                if (!AppendLuaValue(lua, -1, depth + 1, text)) {
+                    return false;
+                }
+                lua_pop(lua, 1);
+            }
+            text += ']';
+            return true;
+        }
+        text += '{';
+        bool first = true;
+        lua_pushnil(lua);
+        while (lua_next(lua, index) != 0) {
+            if (!first) {
+                text += ',';
+            }
+            first = false;
+            if (lua_type(lua, -2) == LUA_TSTRING) {
+                size_t keyLength;
+                const auto key = lua_tolstring(lua, -2, &keyLength);
+                JsonWriter::AppendString(text, key, keyLength);
+            } else if (lua_isinteger(lua, -2)) {
+                text += '"';
+                JsonWriter::AppendInteger(text, (intmax_t)lua_tointeger(lua, -2));
+                text += '"';
+            } else if (lua_type(lua, -2) == LUA_TNUMBER) {
+                lua_pushvalue(lua, -2);
+                size_t keyLength;
+                const auto key = lua_tolstring(lua, -1, &keyLength);
+                JsonWriter::AppendString(text, key, keyLength);
+                lua_pop(lua, 1);
+            } else {
+                lua_pushfstring(lua, "cannot encode a table with a %s key as JSON", lua_typename(lua, lua_type(lua, -2)));
+                return false;
+            }
+            text += ':';
+            if (!AppendLuaValue(lua, -1, depth + 1, text)) {
+                return false;
+            }
+            lua_pop(lua, 1);
+        }
+        text += '}';
+        return true;
+    }
+
+    /**
+     * Append the JSON encoding of the Lua value at the given index on the
+     * Lua stack to the given text.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     *
+     * @param[in] index
+     *     This is the index of the value on the Lua stack.
+     *
+     * @param[in] depth
+     *     This is the number of tables containing the value.
+     *
+     * @param[in,out] text
+     *     This is the text to which to append the encoding.
+     *
+     * @return
+     *     An indication of whether or not the value could be encoded is
+     *     returned.  If not, an error message is pushed onto the Lua stack.
+     */
+    bool AppendLuaValue(lua_State* lua, int index, int depth, std::string& text) {
+        switch (lua_type(lua, index)) {
+            case LUA_TNIL: {
+                text += "null";
+            } break;
+            case LUA_TBOOLEAN: {
+                text += (lua_toboolean(lua, index) ? "true" : "false");
+            } break;
+            case LUA_TNUMBER: {
+                if (lua_isinteger(lua, index)) {
+                    JsonWriter::AppendInteger(text, (intmax_t)lua_tointeger(lua, index));
+                } else {
+                    JsonWriter::AppendNumber(text, (double)lua_tonumber(lua, index));
+                }
+            } break;
+            case LUA_TSTRING: {
+                size_t length;
+                const auto value = lua_tolstring(lua, index, &length);
+                JsonWriter::AppendString(text, value, length);
+            } break;
+            case LUA_TTABLE: {
+                return AppendLuaTable(lua, index, depth, text);
+            }
+            case LUA_TUSERDATA: {
+                if (luaL_testudata(lua, index, "json") != nullptr) {
+                    const auto json = JsonWrapper::TestLua(lua, index);
+                    if (json == nullptr) {
+                        text += "null";
+                    } else {
+                        text += json->ToEncoding();
+                    }
+                    break;
+                }
+            }
+            default: {
+                lua_pushfstring(lua, "cannot encode a %s as JSON", lua_typename(lua, lua_type(lua, index)));
+                return false;
+            }
+        }
+        return true;
+    }
+
     /**
      * This is a Lua function registered as the __gc
      * object metamethod of the "json" class.
@@ -23,8 +237,8 @@ namespace {
      *     The number of values to return from the Lua stack is returned.
      */
     int Finalizer(lua_State* lua) {
-        auto self = (std::shared_ptr< WebSockets::WebSocket >*)luaL_checkudata(lua, 1, "ws");
-        self->~shared_ptr< WebSockets::WebSocket >();
+        auto self = (std::shared_ptr< WebSocketWrapper >*)luaL_checkudata(lua, 1, "ws");
+        self->~shared_ptr< WebSocketWrapper >();
         return 0;
     }
 
@@ -39,12 +253,46 @@ namespace {
      *     The number of values to return from the Lua stack is returned.
      */
     int SendText(lua_State* lua) {
-        auto self = (std::shared_ptr< WebSockets::WebSocket >*)luaL_checkudata(lua, 1, "ws");
-        auto json = (Json::Value*)luaL_checkudata(lua, 2, "json");
+        auto self = (std::shared_ptr< WebSocketWrapper >*)luaL_checkudata(lua, 1, "ws");
+        auto json = JsonWrapper::CheckLua(lua, 2);
         (*self)->SendText(json->ToEncoding());
         return 0;
     }
 
+    /**
+     * This is a Lua function registered as the SendFrame
+     * object method of the "ws" class.  It returns whether or
+     * not the frame was sent.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     *
+     * @return
+     *     The number of values to return from the Lua stack is returned.
+     */
+    int SendFrame(lua_State* lua) {
+        auto self = (std::shared_ptr< WebSocketWrapper >*)luaL_checkudata(lua, 1, "ws");
+        auto json = JsonWrapper::CheckLua(lua, 2);
+        lua_pushboolean(lua, (*self)->SendFrame(json->ToEncoding(), true, 0));
+        return 1;
+    }
+
+    /**
+     * This is a Lua function registered as the SendTable
+     * object method of the "ws" class.
+     *
+     * @param[in] lua
+     *     This points to the Lua interpreter instance.
+     *
+     * @return
+     *     The number of values to return from the Lua stack is returned.
+     */
+    int SendTable(lua_State* lua) {
+        auto self = (std::shared_ptr< WebSocketWrapper >*)luaL_checkudata(lua, 1, "ws");
+        (*self)->SendTable(lua, 2);
+        return 0;
+    }
+
     /**
      * This is a Lua function registered as the __index
      * object metamethod of the "json" class.
@@ -56,9 +304,13 @@ namespace {
      *     The number of values to return from the Lua stack is returned.
      */
     int Index(lua_State* lua) {
-        auto self = (std::shared_ptr< WebSockets::WebSocket >*)luaL_checkudata(lua, 1, "ws");
+        auto self = (std::shared_ptr< WebSocketWrapper >*)luaL_checkudata(lua, 1, "ws");
         const std::string fieldName = luaL_checkstring(lua, 2);
-        if (fieldName == "SendText") {
+        if (fieldName == "SendFrame") {
+            lua_pushcfunction(lua, SendFrame);
+        } else if (fieldName == "SendTable") {
+            lua_pushcfunction(lua, SendTable);
+        } else if (fieldName == "SendText") {
             lua_pushcfunction(lua, SendText);
         } else {
             lua_pushnil(lua);
@@ -68,6 +320,202 @@ namespace {
 
 }
 
+/**
+ * This contains the private properties of a WebSocketWrapper class
+ * instance.
+ */
+struct WebSocketWrapper::Impl {
+    /**
+     * This is used to synchronize access to the other properties.
+     */
+    std::mutex mutex;
+
+    /**
+     * This is the WebSocket wrapped by the instance.
+     */
+    std::shared_ptr< WebSockets::WebSocket > ws;
+
+    /**
+     * These are the settings for compressing the messages sent.
+     */
+    CompressionSettings compressionSettings;
+
+    /**
+     * This compresses the messages sent, if compression is on.
+     */
+    std::unique_ptr< StreamCompressor > compressor;
+
+    /**
+     * This holds the message being sent, after compression.  It is kept
+     * between messages only to reuse its storage.
+     */
+    std::string compressedMessage;
+
+    /**
+     * This holds the encoding of the last table sent from Lua.  It is
+     * kept between messages only to reuse its storage.
+     */
+    std::string tableEncoding;
+
+    /**
+     * This indicates whether or not the last message sent was a frame.
+     * If it wasn't, the next frame is always sent.
+     */
+    bool lastMessageWasFrame = false;
+
+    /**
+     * These describe the contents of the last frame sent: whether or not
+     * it was text, its length, and its hash.
+     */
+    bool lastFrameText = false;
+    size_t lastFrameLength = 0;
+    uint64_t lastFrameHash = 0;
+
+    /**
+     * These are the numbers of bytes sent so far.
+     */
+    Metrics metrics;
+
+    /**
+     * Send a message to the client, compressing it if compression is on.
+     *
+     * @param[in] data
+     *     This is the message to send.
+     *
+     * @param[in] text
+     *     This indicates whether or not the message is text.
+     */
+    void Send(const std::string& data, bool text) {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        lastMessageWasFrame = false;
+        SendWhileLocked(data, text);
+    }
+
+    /**
+     * Send a frame to the client, unless its contents are the same as
+     * those of the last message sent, if that was also a frame.
+     *
+     * @param[in] frame
+     *     This is the frame to send.
+     *
+     * @param[in] text
+     *     This indicates whether or not the frame is text.
+     *
+     * @param[in] headerLength
+     *     This is the number of bytes at the start of the frame to leave
+     *     out when comparing it with the last frame.
+     *
+     * @return
+     *     An indication of whether or not the frame was sent is returned.
+     */
+    bool SendFrame(const std::string& frame, bool text, size_t headerLength) {
+        headerLength = std::min(headerLength, frame.length());
+        const auto contentLength = frame.length() - headerLength;
+        const auto hash = Hash(frame.data() + headerLength, contentLength);
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        if (
+            lastMessageWasFrame
+            && (lastFrameText == text)
+            && (lastFrameLength == contentLength)
+            && (lastFrameHash == hash)
+        ) {
+            ++metrics.framesSuppressed;
+            metrics.bytesSuppressed += frame.length();
+            return false;
+        }
+        lastMessageWasFrame = true;
+        lastFrameText = text;
+        lastFrameLength = contentLength;
+        lastFrameHash = hash;
+        SendWhileLocked(frame, text);
+        return true;
+    }
+
+    /**
+     * Send a message to the client, compressing it if compression is on.
+     * The mutex must be locked when this is called.
+     *
+     * @param[in] data
+     *     This is the message to send.
+     *
+     * @param[in] text
+     *     This indicates whether or not the message is text.
+     */
+    void SendWhileLocked(const std::string& data, bool text) {
+        ++metrics.messagesSent;
+        metrics.bytesIn += data.length();
+        if (compressor == nullptr) {
+            metrics.bytesOut += data.length();
+            if (text) {
+                ws->SendText(data);
+            } else {
+                ws->SendBinary(data);
+            }
+            return;
+        }
+        const char textFlag = (text ? MESSAGE_FLAG_TEXT : 0);
+        if (data.length() >= compressionSettings.threshold) {
+            compressedMessage.assign(1, textFlag | MESSAGE_FLAG_COMPRESSED);
+            compressor->Compress(data, compressedMessage);
+            ++metrics.messagesCompressed;
+        } else {
+            compressedMessage.assign(1, textFlag);
+            compressedMessage += data;
+            compressor->Skip(data);
+        }
+        metrics.bytesOut += compressedMessage.length();
+        ws->SendBinary(compressedMessage);
+    }
+};
+
+const char* const WebSocketWrapper::CompressedSubprotocolSuffix = ".lz4";
+
+WebSocketWrapper::~WebSocketWrapper() noexcept = default;
+
+WebSocketWrapper::WebSocketWrapper(
+    std::shared_ptr< WebSockets::WebSocket > ws,
+    const CompressionSettings& compressionSettings
+)
+    : impl_(new Impl())
+{
+    impl_->ws = ws;
+    impl_->compressionSettings = compressionSettings;
+    if (compressionSettings.enabled) {
+        impl_->compressor.reset(new StreamCompressor(compressionSettings.level));
+    }
+}
+
+void WebSocketWrapper::SendText(const std::string& data) {
+    impl_->Send(data, true);
+}
+
+void WebSocketWrapper::SendBinary(const std::string& data) {
+    impl_->Send(data, false);
+}
+
+void WebSocketWrapper::SendTable(lua_State* lua, int index) {
+    luaL_checktype(lua, index, LUA_TTABLE);
+    impl_->tableEncoding.clear();
+    if (!AppendLuaTable(lua, index, 0, impl_->tableEncoding)) {
+        impl_->tableEncoding.clear();
+        (void)lua_error(lua);
+    }
+    impl_->Send(impl_->tableEncoding, true);
+}
+
+bool WebSocketWrapper::SendFrame(
+    const std::string& frame,
+    bool text,
+    size_t headerLength
+) {
+    return impl_->SendFrame(frame, text, headerLength);
+}
+
+auto WebSocketWrapper::GetMetrics() const -> Metrics {
+    std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+    return impl_->metrics;
+}
+
 void WebSocketWrapper::LinkLua(lua_State* lua) {
     luaL_newmetatable(lua, "ws");
     lua_pushstring(lua, "__gc");
@@ -77,15 +525,15 @@ void WebSocketWrapper::LinkLua(lua_State* lua) {
     lua_pushcfunction(lua, Index);
     lua_settable(lua, -3);
     lua_pushstring(lua, "SendText");
-    lua_pushcfunction(lua, SendText);
+    lua_pushcfunction(lua, ::SendText);
     lua_pop(lua, 1);
 }
 
 void WebSocketWrapper::PushLua(
     lua_State* lua,
-    std::shared_ptr< WebSockets::WebSocket > ws
+    std::shared_ptr< WebSocketWrapper > ws
 ) {
-    auto self = (std::shared_ptr< WebSockets::WebSocket >*)lua_newuserdata(lua, sizeof(std::shared_ptr< WebSockets::WebSocket >));
-    new (self) std::shared_ptr< WebSockets::WebSocket >(ws);
+    auto self = (std::shared_ptr< WebSocketWrapper >*)lua_newuserdata(lua, sizeof(std::shared_ptr< WebSocketWrapper >));
+    new (self) std::shared_ptr< WebSocketWrapper >(ws);
     luaL_setmetatable(lua, "ws");
 }
@@ -3,12 +3,14 @@
 /**
  * @file WebSocketWrapper.hpp
  *
- * This module declares the WebSocketWrapper structure.
+ * This module declares the WebSocketWrapper class.
  *
  * © 2019 by Richard Walters
  */
 
 #include <memory>
+#include <stddef.h>
+#include <string>
 #include <WebSockets/WebSocket.hpp>
 
 extern "C" {
@@ -17,7 +19,181 @@ extern "C" {
 #include <lauxlib.h>
 }
 
-struct WebSocketWrapper {
+/**
+ * This wraps the WebSocket connected to one client, for sending it
+ * messages, both from native code and from Lua.
+ *
+ * Messages may optionally be compressed.  When compression is on, every
+ * message is sent as a binary message whose first byte holds flags:
+ * 1 if the rest of the message is compressed, and 2 if the original
+ * message was text.  Compressed messages are blocks produced by a
+ * StreamCompressor, which carries its history from one message to the
+ * next, so the client must keep the last 64 KiB of the messages it
+ * receives, after decompressing them, to decompress the next one.
+ */
+class WebSocketWrapper {
+    // Types
+public:
+    /**
+     * This holds the settings for compressing the messages sent.
+     */
+    struct CompressionSettings {
+        /**
+         * This indicates whether or not to compress messages.
+         */
+        bool enabled = false;
+
+        /**
+         * This is how hard to compress messages, from 1 (fastest)
+         * to 9 (smallest messages).
+         */
+        int level = 6;
+
+        /**
+         * This is the smallest message worth compressing.  Shorter
+         * messages are sent as they are.
+         */
+        size_t threshold = 64;
+    };
+
+    /**
+     * This holds the numbers of messages and bytes sent, for reporting
+     * how well compression and the suppression of repeated frames are
+     * working.
+     */
+    struct Metrics {
+        /**
+         * This is the number of messages sent.
+         */
+        size_t messagesSent = 0;
+
+        /**
+         * This is the number of messages sent compressed.
+         */
+        size_t messagesCompressed = 0;
+
+        /**
+         * This is the total length of the messages given to send.
+         */
+        size_t bytesIn = 0;
+
+        /**
+         * This is the total length of the messages actually sent.
+         */
+        size_t bytesOut = 0;
+
+        /**
+         * This is the number of frames not sent because they were the
+         * same as the frame sent before them.
+         */
+        size_t framesSuppressed = 0;
+
+        /**
+         * This is the total length of the frames not sent because they
+         * were the same as the frame sent before them.
+         */
+        size_t bytesSuppressed = 0;
+    };
+
+    // Public Properties
+public:
+    /**
+     * This is added to the name of a WebSocket subprotocol to make the
+     * name of the same subprotocol with compressed messages.
+     */
+    static const char* const CompressedSubprotocolSuffix;
+
+    // Lifecycle Methods
+public:
+    ~WebSocketWrapper() noexcept;
+    WebSocketWrapper(const WebSocketWrapper&) = delete;
+    WebSocketWrapper(WebSocketWrapper&&) noexcept = delete;
+    WebSocketWrapper& operator=(const WebSocketWrapper&) = delete;
+    WebSocketWrapper& operator=(WebSocketWrapper&&) noexcept = delete;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     *
+     * @param[in] ws
+     *     This is the WebSocket to wrap.
+     *
+     * @param[in] compressionSettings
+     *     These are the settings for compressing the messages sent.
+     */
+    WebSocketWrapper(
+        std::shared_ptr< WebSockets::WebSocket > ws,
+        const CompressionSettings& compressionSettings
+    );
+
+    /**
+     * Send a text message to the client.
+     *
+     * @param[in] data
+     *     This is the message to send.
+     */
+    void SendText(const std::string& data);
+
+    /**
+     * Send a binary message to the client.
+     *
+     * @param[in] data
+     *     This is the message to send.
+     */
+    void SendBinary(const std::string& data);
+
+    /**
+     * Send a frame to the client, unless it is the same as the last
+     * message sent, and that was also a frame.  A frame is a message
+     * which describes state completely, such as the latest values of
+     * some properties, so that sending the same frame twice in a row
+     * tells the client nothing new.  Frames are compared by a hash
+     * of their contents, kept for the connection.
+     *
+     * @param[in] frame
+     *     This is the frame to send.
+     *
+     * @param[in] text
+     *     This indicates whether the frame is a text message (true)
+     *     or a binary message (false).
+     *
+     * @param[in] headerLength
+     *     This is the number of bytes at the start of the frame, such as
+     *     a sequence number, to leave out when comparing frames.
+     *
+     * @return
+     *     An indication of whether or not the frame was sent is returned.
+     */
+    bool SendFrame(
+        const std::string& frame,
+        bool text,
+        size_t headerLength
+    );
+
+    /**
+     * Send the client a text message holding the JSON encoding of the
+     * Lua table at the given index on the Lua stack.  The table is
+     * encoded straight into a buffer kept for the connection, without
+     * building a Json::Value.  This raises a Lua error if the value isn't
+     * a table, or holds values which can't be encoded as JSON.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] index
+     *     This is the index of the table on the Lua stack.
+     */
+    void SendTable(lua_State* lua, int index);
+
+    /**
+     * Return the numbers of messages and bytes sent so far.
+     *
+     * @return
+     *     The numbers of messages and bytes sent so far are returned.
+     */
+    Metrics GetMetrics() const;
+
     /**
      * Link the class with the given Lua interpreter.
      *
@@ -27,16 +203,30 @@ struct WebSocketWrapper {
     static void LinkLua(lua_State* lua);
 
     /**
-     * Push the given WebSocket onto the Lua stack.
+     * Push the given WebSocket wrapper onto the Lua stack.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
      *
      * @param[in] ws
-     *     This is the WebSocket to push onto the Lua stack.
+     *     This is the WebSocket wrapper to push onto the Lua stack.
      */
     static void PushLua(
         lua_State* lua,
-        std::shared_ptr< WebSockets::WebSocket > ws
+        std::shared_ptr< WebSocketWrapper > ws
     );
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
 };
@@ -1,17 +1,23 @@
+#include "AtomTable.hpp"
 #include "Components.hpp"
 #include "game.hpp"
+#include "InputMessage.hpp"
+#include "JsonWrapper.hpp"
+#include "RenderFrameEncoder.hpp"
 #include "ScriptHost.hpp"
+#include "SpscRing.hpp"
 #include "WebSocketWrapper.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <future>
 #include <Json/Value.hpp>
 #include <math.h>
-#include <mutex>
 #include <string>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
 #include <SystemAbstractions/File.hpp>
 #include <thread>
+#include <vector>
 
 namespace {
 
@@ -40,19 +46,109 @@ namespace {
         );
     }
 
+    /**
+     * This is the most ticks allowed between keyframes sent to
+     * the client.
+     */
+    constexpr size_t KEYFRAME_INTERVAL_TICKS = 100;
+
+    /**
+     * This is the most input messages from the client which can wait
+     * to be applied at the start of the next tick.
+     */
+    constexpr size_t INPUT_QUEUE_CAPACITY = 256;
+
 }
 
 struct Game::Impl
     : public std::enable_shared_from_this< Game::Impl >
 {
     std::shared_ptr< WebSockets::WebSocket > ws;
+    std::shared_ptr< WebSocketWrapper > wsWrapper;
     std::shared_ptr< TimeKeeper > timeKeeper;
+    std::shared_ptr< AtomTable > atoms;
     CompleteDelegate completeDelegate;
     std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender;
     Components components;
     ScriptHost scriptHost;
-    std::mutex mutex;
+    int floorKind = 0;
+    int wallKind = 0;
     std::promise< void > stopWorker;
+
+    /**
+     * This holds the input messages received from the client which the
+     * worker hasn't yet applied.  The thread receiving messages pushes
+     * them, and the worker pops them at the start of each tick, so
+     * neither ever waits for the other.
+     */
+    SpscRing< InputMessage, INPUT_QUEUE_CAPACITY > inputQueue;
+
+    /**
+     * This counts the input messages dropped because the input queue
+     * was full.
+     */
+    std::atomic< size_t > inputsDropped{0};
+
+    /**
+     * This is how many dropped input messages the worker has reported.
+     */
+    size_t inputsDroppedReported = 0;
+
+    std::unique_ptr< RenderFrameEncoder > renderFrameEncoder;
+
+    /**
+     * These are the IDs of the entities visited by the render stage
+     * in the current tick.  They are kept between ticks only to reuse
+     * their storage.
+     */
+    std::vector< EntityId > renderEntityIds;
+
+    /**
+     * These are the sprites put in the render frame of the current tick.
+     * They are kept between ticks only to reuse their storage.
+     */
+    std::vector< RenderSprite > renderSprites;
+
+    /**
+     * These are the custom fields put in the render frame of the current
+     * tick.
+     */
+    Json::Value renderFields;
+
+    /**
+     * These are the IDs of the entities whose tiles are destroyed once
+     * the render frame of the current tick has been sent.
+     */
+    std::vector< EntityId > renderDestroyedEntityIds;
+
+    /**
+     * This is the encoding of the render frame built for the current
+     * tick.  It is kept between ticks only to reuse its storage.
+     */
+    std::string renderFrame;
+
+    /**
+     * These are the custom fields of the last render frame sent to the
+     * client.
+     */
+    Json::Value previousRenderFields;
+
+    /**
+     * This is the sequence number of the next render frame to send.
+     */
+    size_t renderSequence = 0;
+
+    /**
+     * This is the tick in which the last keyframe was sent.
+     */
+    size_t lastKeyframeTick = 0;
+
+    /**
+     * This indicates whether or not the next render frame should be a
+     * keyframe.  The first frame always is.
+     */
+    bool keyframeRequested = true;
+
     std::thread worker;
 
     explicit Impl(const std::string& id)
@@ -108,44 +204,78 @@ struct Game::Impl
     }
 
     void OnWebSocketText(const std::string& data) {
-        std::lock_guard< decltype(mutex) > lock(mutex);
+        const auto message = InputMessage::FromEncoding(data);
+        if (message.type == InputMessage::Type::Unknown) {
+            return;
+        }
+        if (!inputQueue.Push(message)) {
+            ++inputsDropped;
+        }
+    }
+
+    /**
+     * Apply an input message received from the client.
+     *
+     * @param[in] message
+     *     This is the input message to apply.
+     */
+    void ApplyInput(const InputMessage& message) {
+        if (message.type == InputMessage::Type::Resync) {
+            keyframeRequested = true;
+            return;
+        }
         const auto inputsInfo = components.GetComponentsOfType(Components::Type::Input);
         if (inputsInfo.n == 0) {
             return;
         }
-        auto& input = ((Input*)inputsInfo.first)[0];
-        const auto message = Json::Value::FromEncoding(data);
-        if (message["type"] == "fire") {
-            const auto keyString = (std::string)message["key"];
-            if (keyString.empty()) {
+        auto& input = *(Input*)inputsInfo.pages[0].first;
+        if (message.type == InputMessage::Type::Fire) {
+            if (message.key == 0) {
                 input.fireReleased = true;
                 if (!input.fireThisTick) {
                     input.fire = 0;
                 }
             } else {
-                const auto key = keyString[0];
                 input.fireReleased = false;
                 input.fireThisTick = true;
-                input.fire = key;
+                input.fire = message.key;
             }
-        } else if (message["type"] == "move") {
-            const auto keyString = (std::string)message["key"];
-            if (keyString.empty()) {
+        } else if (message.type == InputMessage::Type::Move) {
+            if (message.key == 0) {
                 input.moveReleased = true;
                 if (!input.moveThisTick) {
                     input.move = 0;
                 }
             } else {
-                const auto key = keyString[0];
                 input.moveReleased = false;
                 input.moveThisTick = true;
-                input.move = key;
+                input.move = message.key;
             }
-        } else if (message["type"] == "potion") {
+        } else if (message.type == InputMessage::Type::Potion) {
             input.usePotion = true;
         }
     }
 
+    /**
+     * Apply, in the order they were received, all input messages
+     * received from the client since the last tick.
+     */
+    void DrainInputs() {
+        InputMessage message;
+        while (inputQueue.Pop(message)) {
+            ApplyInput(message);
+        }
+        const auto dropped = inputsDropped.load();
+        if (dropped != inputsDroppedReported) {
+            diagnosticsSender->SendDiagnosticInformationFormatted(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                "Input queue full; %zu input messages dropped",
+                dropped - inputsDroppedReported
+            );
+            inputsDroppedReported = dropped;
+        }
+    }
+
     void SetWebSocketDelegates() {
         WebSockets::WebSocket::Delegates delegates;
         std::weak_ptr< Impl > implWeak(shared_from_this());
@@ -173,127 +303,357 @@ struct Game::Impl
 
     void AddPlayer(unsigned int x, unsigned int y) {
         const auto id = components.CreateEntity();
-        const auto collider = (Collider*)components.CreateComponentOfType(Components::Type::Collider, id);
-        const auto health = (Health*)components.CreateComponentOfType(Components::Type::Health, id);
+        (void)components.CreateComponentOfType(Components::Type::Collider, id);
+        (void)components.CreateComponentOfType(Components::Type::Health, id);
         const auto hero = (Hero*)components.CreateComponentOfType(Components::Type::Hero, id);
         const auto input = (Input*)components.CreateComponentOfType(Components::Type::Input, id);
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
+        (void)components.CreateComponentOfType(Components::Type::Position, id);
         const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
-        collider->mask = 1;
-        tile->name = "hero";
+        components.SetColliderMask(id, 1);
+        tile->name = atoms->Intern("hero");
         tile->z = 2;
-        position->x = x;
-        position->y = y;
-        health->hp = 100;
+        components.SetPosition(id, x, y);
+        components.SetHealth(id, 100);
         hero->score = 0;
         hero->potions = 0;
     }
 
     void AddMonster(unsigned int x, unsigned int y) {
         const auto id = components.CreateEntity();
-        const auto collider = (Collider*)components.CreateComponentOfType(Components::Type::Collider, id);
-        const auto health = (Health*)components.CreateComponentOfType(Components::Type::Health, id);
+        (void)components.CreateComponentOfType(Components::Type::Collider, id);
+        (void)components.CreateComponentOfType(Components::Type::Health, id);
         const auto monster = (Monster*)components.CreateComponentOfType(Components::Type::Monster, id);
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
+        (void)components.CreateComponentOfType(Components::Type::Position, id);
         const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
         const auto reward = (Reward*)components.CreateComponentOfType(Components::Type::Reward, id);
-        collider->mask = 2;
-        tile->name = "monster";
+        components.SetColliderMask(id, 2);
+        tile->name = atoms->Intern("monster");
         tile->z = 2;
-        position->x = x;
-        position->y = y;
-        health->hp = 1;
+        components.SetPosition(id, x, y);
+        components.SetHealth(id, 1);
         reward->score = 10;
     }
 
     void AddGenerator(unsigned int x, unsigned int y) {
         const auto id = components.CreateEntity();
-        const auto collider = (Collider*)components.CreateComponentOfType(Components::Type::Collider, id);
+        (void)components.CreateComponentOfType(Components::Type::Collider, id);
         const auto generator = (Generator*)components.CreateComponentOfType(Components::Type::Generator, id);
-        const auto health = (Health*)components.CreateComponentOfType(Components::Type::Health, id);
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
+        (void)components.CreateComponentOfType(Components::Type::Health, id);
+        (void)components.CreateComponentOfType(Components::Type::Position, id);
         const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
         const auto reward = (Reward*)components.CreateComponentOfType(Components::Type::Reward, id);
-        collider->mask = ~0;
-        tile->name = "bones";
+        components.SetColliderMask(id, ~0);
+        tile->name = atoms->Intern("bones");
         tile->z = 1;
-        position->x = x;
-        position->y = y;
+        components.SetPosition(id, x, y);
         generator->spawnChance = 0.05;
-        health->hp = 10;
+        components.SetHealth(id, 10);
         reward->score = 250;
     }
 
+    void AddStaticTileKinds() {
+        Components::StaticTileKind floor;
+        floor.name = atoms->Intern("floor");
+        floor.z = 0;
+        floorKind = components.AddStaticTileKind(floor);
+        Components::StaticTileKind wall;
+        wall.name = atoms->Intern("wall");
+        wall.z = 1;
+        wall.mask = ~0;
+        wallKind = components.AddStaticTileKind(wall);
+    }
+
     void AddWall(unsigned int x, unsigned int y) {
-        const auto id = components.CreateEntity();
-        const auto collider = (Collider*)components.CreateComponentOfType(Components::Type::Collider, id);
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
-        const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
-        collider->mask = ~0;
-        tile->name = "wall";
-        tile->z = 1;
-        position->x = x;
-        position->y = y;
+        components.SetStaticTile(x, y, wallKind);
     }
 
     void AddFloor(unsigned int x, unsigned int y) {
-        const auto id = components.CreateEntity();
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
-        const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
-        tile->name = "floor";
-        tile->z = 0;
-        position->x = x;
-        position->y = y;
+        components.SetStaticTile(x, y, floorKind);
     }
 
     void AddTreasure(unsigned int x, unsigned int y) {
         const auto id = components.CreateEntity();
         const auto pickup = (Pickup*)components.CreateComponentOfType(Components::Type::Pickup, id);
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
+        (void)components.CreateComponentOfType(Components::Type::Position, id);
         const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
-        tile->name = "treasure";
+        tile->name = atoms->Intern("treasure");
         tile->z = 1;
-        position->x = x;
-        position->y = y;
+        components.SetPosition(id, x, y);
         pickup->type = Pickup::Type::Treasure;
     }
 
     void AddFood(unsigned int x, unsigned int y) {
         const auto id = components.CreateEntity();
         const auto pickup = (Pickup*)components.CreateComponentOfType(Components::Type::Pickup, id);
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
+        (void)components.CreateComponentOfType(Components::Type::Position, id);
         const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
-        tile->name = "food";
+        tile->name = atoms->Intern("food");
         tile->z = 1;
-        position->x = x;
-        position->y = y;
+        components.SetPosition(id, x, y);
         pickup->type = Pickup::Type::Food;
     }
 
     void AddPotion(unsigned int x, unsigned int y) {
         const auto id = components.CreateEntity();
         const auto pickup = (Pickup*)components.CreateComponentOfType(Components::Type::Pickup, id);
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
+        (void)components.CreateComponentOfType(Components::Type::Position, id);
         const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
-        tile->name = "potion";
+        tile->name = atoms->Intern("potion");
         tile->z = 1;
-        position->x = x;
-        position->y = y;
+        components.SetPosition(id, x, y);
         pickup->type = Pickup::Type::Potion;
     }
 
     void AddExit(unsigned int x, unsigned int y) {
         const auto id = components.CreateEntity();
         const auto pickup = (Pickup*)components.CreateComponentOfType(Components::Type::Pickup, id);
-        const auto position = (Position*)components.CreateComponentOfType(Components::Type::Position, id);
+        (void)components.CreateComponentOfType(Components::Type::Position, id);
         const auto tile = (Tile*)components.CreateComponentOfType(Components::Type::Tile, id);
-        tile->name = "exit";
+        tile->name = atoms->Intern("exit");
         tile->z = 1;
-        position->x = x;
-        position->y = y;
+        components.SetPosition(id, x, y);
         pickup->type = Pickup::Type::Exit;
     }
 
+    /**
+     * Send the client a render frame.  Keyframes are always sent, but
+     * any other frame is dropped if it is the same as the frame sent
+     * before it, apart from its sequence number.  Frames hold the
+     * latest state of their sprites, so such a frame changes nothing.
+     *
+     * @param[in] frame
+     *     This is the encoding of the render frame to send.
+     *
+     * @param[in] sequenceEnd
+     *     This is the length of the part of the frame up to and
+     *     including its sequence number.
+     *
+     * @param[in] keyframe
+     *     This indicates whether or not the frame is a keyframe.
+     *
+     * @return
+     *     An indication of whether or not the frame was sent is returned.
+     */
+    bool SendRenderFrame(
+        const std::string& frame,
+        size_t sequenceEnd,
+        bool keyframe
+    ) {
+        const auto text = (renderFrameEncoder->GetFormat() != RenderFrameEncoder::Format::Binary);
+        if (keyframe) {
+            if (text) {
+                wsWrapper->SendText(frame);
+            } else {
+                wsWrapper->SendBinary(frame);
+            }
+            return true;
+        }
+        return wsWrapper->SendFrame(frame, text, sequenceEnd);
+    }
+
+    /**
+     * Add to the render frame the sprites of the whole static layer.
+     * Static tiles are given negative sprite IDs, so that they never
+     * clash with the IDs of entities.
+     */
+    void RenderStaticLayer() {
+        const auto width = components.GetStaticLayerWidth();
+        const auto height = components.GetStaticLayerHeight();
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const auto staticTile = components.GetStaticTile(x, y);
+                if (staticTile == nullptr) {
+                    continue;
+                }
+                RenderSprite sprite;
+                sprite.id = -(y * width + x + 1);
+                sprite.texture = staticTile->name;
+                sprite.x = x;
+                sprite.y = y;
+                sprite.z = staticTile->z;
+                renderSprites.push_back(sprite);
+            }
+        }
+    }
+
+    /**
+     * Add to the render frame the sprite of the given entity, if it has
+     * a tile.  A destroyed tile is queued to be destroyed once the frame
+     * is sent, and is sent as a destroyed sprite unless the frame is a
+     * keyframe, which only holds sprites the client should draw.
+     *
+     * @param[in] entityId
+     *     This is the ID of the entity whose sprite should be added.
+     *
+     * @param[in] keyframe
+     *     This indicates whether or not the frame is a keyframe.
+     */
+    void RenderEntity(EntityId entityId, bool keyframe) {
+        const auto tile = (Tile*)components.GetEntityComponentOfType(Components::Type::Tile, entityId);
+        if (tile == nullptr) {
+            return;
+        }
+        RenderSprite sprite;
+        sprite.id = (int64_t)entityId;
+        if (tile->destroyed) {
+            if (!keyframe) {
+                sprite.destroyed = true;
+                renderSprites.push_back(sprite);
+            }
+            renderDestroyedEntityIds.push_back(entityId);
+            return;
+        }
+        const auto position = (Position*)components.GetEntityComponentOfType(Components::Type::Position, entityId);
+        if (position == nullptr) {
+            return;
+        }
+        sprite.texture = tile->name;
+        sprite.x = position->GetX();
+        sprite.y = position->GetY();
+        sprite.z = tile->z;
+        sprite.phase = tile->phase;
+        sprite.spinning = tile->spinning;
+        const auto weapon = (Weapon*)components.GetEntityComponentOfType(Components::Type::Weapon, entityId);
+        if (weapon != nullptr) {
+            sprite.moving = true;
+            sprite.dx = weapon->GetDx();
+            sprite.dy = weapon->GetDy();
+        }
+        renderSprites.push_back(sprite);
+    }
+
+    /**
+     * Collect the IDs of the entities whose tiles, positions or weapons
+     * changed during the current tick.
+     */
+    void CollectChangedEntities() {
+        renderEntityIds.clear();
+        for (const auto type: {
+            Components::Type::Tile,
+            Components::Type::Position,
+            Components::Type::Weapon,
+        }) {
+            const auto& changedEntityIds = components.GetChangedEntityIds(type);
+            renderEntityIds.insert(
+                renderEntityIds.end(),
+                changedEntityIds.begin(),
+                changedEntityIds.end()
+            );
+        }
+        std::sort(renderEntityIds.begin(), renderEntityIds.end());
+        renderEntityIds.erase(
+            std::unique(renderEntityIds.begin(), renderEntityIds.end()),
+            renderEntityIds.end()
+        );
+    }
+
+    /**
+     * Collect the IDs of all entities which have tiles.
+     */
+    void CollectAllEntities() {
+        renderEntityIds.clear();
+        const auto tiles = components.GetComponentsOfType(Components::Type::Tile);
+        for (const auto& page: tiles.pages) {
+            const auto pageTiles = (Tile*)page.first;
+            for (size_t i = 0; i < page.n; ++i) {
+                renderEntityIds.push_back(pageTiles[i].entityId);
+            }
+        }
+    }
+
+    /**
+     * Collect any custom fields for the render frame provided by the
+     * systems.  The systems provide them by defining a RenderFields
+     * function, which is called with the components, a JSON object to
+     * fill in with the fields, and the tick.
+     *
+     * @param[in] tick
+     *     This is the number of the current tick.
+     */
+    void RenderCustomFields(size_t tick) {
+        renderFields = Json::Value(Json::Value::Type::Object);
+        const auto lua = scriptHost.GetLua();
+        lua_settop(lua, 0);
+        if (lua_getglobal(lua, "RenderFields") != LUA_TFUNCTION) {
+            lua_settop(lua, 0);
+            return;
+        }
+        lua_settop(lua, 0);
+        components.PushLua(lua);
+        const auto fields = JsonWrapper::PushLua(lua, Json::Value(Json::Value::Type::Object));
+        lua_pushvalue(lua, -1);
+        const auto fieldsRef = luaL_ref(lua, LUA_REGISTRYINDEX);
+        lua_pushinteger(lua, (lua_Integer)tick);
+        const auto errorMessage = scriptHost.Call("RenderFields");
+        if (errorMessage.empty()) {
+            renderFields = *fields;
+        } else {
+            diagnosticsSender->SendDiagnosticInformationString(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                std::string("Error rendering custom fields: ") + errorMessage
+            );
+        }
+        luaL_unref(lua, LUA_REGISTRYINDEX, fieldsRef);
+    }
+
+    /**
+     * Build the render frame for the current tick directly from the
+     * component state, and send it to the client.
+     *
+     * Most frames are deltas, holding only the sprites of entities whose
+     * tiles, positions or weapons changed during the tick.  A keyframe,
+     * holding every sprite, is sent first, every KEYFRAME_INTERVAL_TICKS
+     * ticks after that, and whenever the client asks for one.  Frames are
+     * numbered in sequence, so that a client can tell when it's missed
+     * one, and ask for a keyframe to catch up.  Deltas with no sprites
+     * and no change in the custom fields aren't sent.
+     *
+     * @param[in] tick
+     *     This is the number of the current tick.
+     */
+    void Render(size_t tick) {
+        const auto keyframe = (
+            keyframeRequested
+            || (tick - lastKeyframeTick >= KEYFRAME_INTERVAL_TICKS)
+        );
+        renderSprites.clear();
+        renderDestroyedEntityIds.clear();
+        if (keyframe) {
+            RenderStaticLayer();
+            CollectAllEntities();
+        } else {
+            CollectChangedEntities();
+        }
+        for (const auto entityId: renderEntityIds) {
+            RenderEntity(entityId, keyframe);
+        }
+        RenderCustomFields(tick);
+        if (
+            keyframe
+            || !renderSprites.empty()
+            || (renderFields != previousRenderFields)
+        ) {
+            const auto sequenceEnd = renderFrameEncoder->Encode(
+                renderSprites,
+                renderFields,
+                renderSequence,
+                keyframe,
+                renderFrame
+            );
+            if (SendRenderFrame(renderFrame, sequenceEnd, keyframe)) {
+                ++renderSequence;
+            }
+            previousRenderFields = renderFields;
+            if (keyframe) {
+                keyframeRequested = false;
+                lastKeyframeTick = tick;
+            }
+        }
+        for (const auto entityId: renderDestroyedEntityIds) {
+            components.DestroyEntityComponentOfType(Components::Type::Tile, entityId);
+        }
+    }
+
     void Worker() {
         diagnosticsSender->SendDiagnosticInformationString(
             3,
@@ -317,10 +677,10 @@ struct Game::Impl
             }
             const auto start = timeKeeper->GetCurrentTime();
             ++tick;
-            std::lock_guard< decltype(mutex) > lock(mutex);
+            DrainInputs();
             const auto lua = scriptHost.GetLua();
             components.PushLua(lua);
-            WebSocketWrapper::PushLua(lua, ws);
+            WebSocketWrapper::PushLua(lua, wsWrapper);
             lua_pushinteger(lua, (lua_Integer)tick);
             const auto errorMessage = scriptHost.Call("update");
             if (!errorMessage.empty()) {
@@ -329,6 +689,8 @@ struct Game::Impl
                     std::string("Error updating systems: ") + errorMessage
                 );
             }
+            Render(tick);
+            components.ResetChanged();
             const auto finish = timeKeeper->GetCurrentTime();
             const auto measurement = (finish - start);
             if (numMeasurements == 0) {
@@ -348,6 +710,26 @@ struct Game::Impl
                     maxMeasurement
                 );
                 numMeasurements = 0;
+                const auto metrics = wsWrapper->GetMetrics();
+                if (metrics.framesSuppressed > 0) {
+                    diagnosticsSender->SendDiagnosticInformationFormatted(
+                        3,
+                        "repeated frames suppressed: frames=%zu bytes=%zu",
+                        metrics.framesSuppressed,
+                        metrics.bytesSuppressed
+                    );
+                }
+                if (metrics.messagesCompressed > 0) {
+                    diagnosticsSender->SendDiagnosticInformationFormatted(
+                        3,
+                        "compression: messages=%zu compressed=%zu in=%zu out=%zu ratio=%lf",
+                        metrics.messagesSent,
+                        metrics.messagesCompressed,
+                        metrics.bytesIn,
+                        metrics.bytesOut,
+                        (double)metrics.bytesIn / metrics.bytesOut
+                    );
+                }
             }
         }
         diagnosticsSender->SendDiagnosticInformationString(
@@ -366,6 +748,9 @@ Game::Game(const std::string& id)
 void Game::Start(
     std::shared_ptr< WebSockets::WebSocket > ws,
     std::shared_ptr< TimeKeeper > timeKeeper,
+    std::shared_ptr< AtomTable > atoms,
+    RenderFrameEncoder::Format frameFormat,
+    const WebSocketWrapper::CompressionSettings& compressionSettings,
     SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate diagnosticMessageDelegate,
     CompleteDelegate completeDelegate
 ) {
@@ -375,7 +760,11 @@ void Game::Start(
         "Try this level now!"
     );
     impl_->ws = ws;
+    impl_->wsWrapper = std::make_shared< WebSocketWrapper >(ws, compressionSettings);
     impl_->timeKeeper = timeKeeper;
+    impl_->atoms = atoms;
+    impl_->components.SetAtomTable(atoms);
+    impl_->renderFrameEncoder.reset(new RenderFrameEncoder(frameFormat, atoms));
     impl_->completeDelegate = completeDelegate;
     impl_->LoadSystems();
     impl_->BuildComponentTypes();
@@ -392,7 +781,8 @@ void Game::Start(
     impl_->AddPotion(6, 6);
     impl_->AddPotion(2, 6);
     impl_->AddPotion(3, 7);
-    impl_->AddExit(13, 11);
+    impl_->components.SetStaticLayerSize(15, 13);
+    impl_->AddStaticTileKinds();
     for (int y = 0; y <= 12; ++y) {
         for (int x = 0; x <= 14; ++x) {
             if (
@@ -412,6 +802,7 @@ void Game::Start(
             }
         }
     }
+    impl_->AddExit(13, 11);
     impl_->SetWebSocketDelegates();
     impl_->worker = std::thread(&Impl::Worker, impl_.get());
 }
@@ -8,7 +8,10 @@
  * © 2019 by Richard Walters
  */
 
+#include "AtomTable.hpp"
+#include "RenderFrameEncoder.hpp"
 #include "TimeKeeper.hpp"
+#include "WebSocketWrapper.hpp"
 
 #include <functional>
 #include <memory>
@@ -40,6 +43,9 @@ public:
     void Start(
         std::shared_ptr< WebSockets::WebSocket > ws,
         std::shared_ptr< TimeKeeper > timeKeeper,
+        std::shared_ptr< AtomTable > atoms,
+        RenderFrameEncoder::Format frameFormat,
+        const WebSocketWrapper::CompressionSettings& compressionSettings,
         SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate diagnosticMessageDelegate,
         CompleteDelegate completeDelegate
     );
@@ -7,8 +7,11 @@
  * © 2018 by Richard Walters
  */
 
+#include "AtomTable.hpp"
 #include "game.hpp"
+#include "RenderFrameEncoder.hpp"
 #include "TimeKeeper.hpp"
+#include "WebSocketWrapper.hpp"
 
 #include <functional>
 #include <Http/Server.hpp>
@@ -51,10 +54,62 @@ namespace {
     using WebSocketDelegate = std::function<
         void(
             const std::string& id,
-            std::shared_ptr< WebSockets::WebSocket > ws
+            std::shared_ptr< WebSockets::WebSocket > ws,
+            RenderFrameEncoder::Format frameFormat,
+            bool compressed
         )
     >;
 
+    /**
+     * Pick the WebSocket subprotocol for a client opening a WebSocket,
+     * from those it requests, which decides the format in which render
+     * frames are sent and whether or not messages are compressed.  The
+     * first subprotocol the client requests which is supported is picked,
+     * and the client is told so in the response.  Clients which request
+     * no supported subprotocol are sent uncompressed JSON frames.
+     *
+     * @param[in] request
+     *     This is the request from the client opening the WebSocket.
+     *
+     * @param[in,out] response
+     *     This is the response opening the WebSocket.
+     *
+     * @param[out] frameFormat
+     *     This is where to store the format in which to send render frames.
+     *
+     * @param[out] compressed
+     *     This is where to store whether or not to compress messages.
+     */
+    void NegotiateSubprotocol(
+        const Http::Request& request,
+        Http::Response& response,
+        RenderFrameEncoder::Format& frameFormat,
+        bool& compressed
+    ) {
+        frameFormat = RenderFrameEncoder::Format::Json;
+        compressed = false;
+        const std::string suffix = WebSocketWrapper::CompressedSubprotocolSuffix;
+        const auto protocols = request.headers.GetHeaderTokens("Sec-WebSocket-Protocol");
+        for (const auto& protocol: protocols) {
+            auto baseProtocol = protocol;
+            const auto protocolCompressed = (
+                (protocol.length() > suffix.length())
+                && (protocol.compare(protocol.length() - suffix.length(), suffix.length(), suffix) == 0)
+            );
+            if (protocolCompressed) {
+                baseProtocol = protocol.substr(0, protocol.length() - suffix.length());
+            }
+            if (baseProtocol == RenderFrameEncoder::BinarySubprotocol) {
+                frameFormat = RenderFrameEncoder::Format::Binary;
+            } else if (baseProtocol != RenderFrameEncoder::JsonSubprotocol) {
+                continue;
+            }
+            compressed = protocolCompressed;
+            response.headers.SetHeader("Sec-WebSocket-Protocol", protocol);
+            return;
+        }
+    }
+
     bool SetUpWebServer(
         Http::Server& webServer,
         std::shared_ptr< TimeKeeper > timeKeeper,
@@ -82,7 +137,10 @@ namespace {
                 const auto ws = std::make_shared< WebSockets::WebSocket >();
                 (void)ws->SubscribeToDiagnostics(diagnosticMessageDelegate);
                 if (ws->OpenAsServer(connection, request, response, trailer)) {
-                    webSocketDelegate(connection->GetPeerId(), ws);
+                    RenderFrameEncoder::Format frameFormat;
+                    bool compressed;
+                    NegotiateSubprotocol(request, response, frameFormat, compressed);
+                    webSocketDelegate(connection->GetPeerId(), ws, frameFormat, compressed);
                 } else {
                     response.statusCode = 404;
                     response.reasonPhrase = "Not Found";
@@ -98,6 +156,38 @@ namespace {
         return true;
     }
 
+    /**
+     * Read the settings for compressing messages sent to clients from
+     * the command line.  The level is given as "--compression-level=N"
+     * and the threshold as "--compression-threshold=N".  Settings not
+     * given keep their default values.
+     *
+     * @param[in] argc
+     *     This is the number of command-line arguments given to the program.
+     *
+     * @param[in] argv
+     *     This is the array of command-line arguments given to the program.
+     *
+     * @return
+     *     The settings for compressing messages are returned.
+     */
+    WebSocketWrapper::CompressionSettings ParseCompressionSettings(
+        int argc,
+        char* argv[]
+    ) {
+        WebSocketWrapper::CompressionSettings compressionSettings;
+        for (int i = 1; i < argc; ++i) {
+            int level;
+            size_t threshold;
+            if (sscanf(argv[i], "--compression-level=%d", &level) == 1) {
+                compressionSettings.level = level;
+            } else if (sscanf(argv[i], "--compression-threshold=%zu", &threshold) == 1) {
+                compressionSettings.threshold = threshold;
+            }
+        }
+        return compressionSettings;
+    }
+
     void TearDownWebServer(Http::Server& webServer) {
         webServer.Demobilize();
     }
@@ -136,15 +226,21 @@ int main(int argc, char* argv[]) {
     (void)setbuf(stdout, NULL);
     auto diagnosticsPublisher = SystemAbstractions::DiagnosticsStreamReporter(stdout, stderr);
     const auto timeKeeper = std::make_shared< TimeKeeper >();
+    const auto atoms = std::make_shared< AtomTable >();
+    const auto compressionSettings = ParseCompressionSettings(argc, argv);
     const auto webServer = std::make_shared< Http::Server >();
     std::set< std::shared_ptr< Game > > games;
     const auto webSocketDelegate = [
         &games,
         timeKeeper,
+        atoms,
+        compressionSettings,
         diagnosticsPublisher
     ](
         const std::string& id,
-        std::shared_ptr< WebSockets::WebSocket > ws
+        std::shared_ptr< WebSockets::WebSocket > ws,
+        RenderFrameEncoder::Format frameFormat,
+        bool compressed
     ){
         const auto game = std::make_shared< Game >(id);
         std::weak_ptr< Game > gameWeak(game);
@@ -156,7 +252,9 @@ int main(int argc, char* argv[]) {
             (void)games.erase(game);
         };
         (void)games.insert(game);
-        game->Start(ws, timeKeeper, diagnosticsPublisher, completeDelegate);
+        auto gameCompressionSettings = compressionSettings;
+        gameCompressionSettings.enabled = compressed;
+        game->Start(ws, timeKeeper, atoms, frameFormat, gameCompressionSettings, diagnosticsPublisher, completeDelegate);
     };
     if (
         !SetUpWebServer(
@@ -1,13 +1,23 @@
+-- Component type tokens, which identify component types more quickly
+-- than their names.  These are refreshed at the start of each update.
+local T = {}
+
+-- Systems which visit many entities iterate with components:Each rather
+-- than components:Query.  Each yields the same component objects at every
+-- step, pointed at the next entity's components, so it makes no garbage,
+-- but a component it yields must not be kept beyond its step.  Keep the
+-- entity ID instead, as these systems do.
+
 -- Utilities
 
 function AddMonster(components, x, y)
     local id = components:CreateEntity()
-    local collider = components:CreateComponentOfType("collider", id)
-    local health = components:CreateComponentOfType("health", id)
-    local monster = components:CreateComponentOfType("monster", id)
-    local position = components:CreateComponentOfType("position", id)
-    local tile = components:CreateComponentOfType("tile", id)
-    local reward = components:CreateComponentOfType("reward", id)
+    local collider = components:CreateComponentOfType(T.collider, id)
+    local health = components:CreateComponentOfType(T.health, id)
+    local monster = components:CreateComponentOfType(T.monster, id)
+    local position = components:CreateComponentOfType(T.position, id)
+    local tile = components:CreateComponentOfType(T.tile, id)
+    local reward = components:CreateComponentOfType(T.reward, id)
     collider.mask = 2
     tile.name = "monster"
     tile.z = 1
@@ -17,37 +27,19 @@ function AddMonster(components, x, y)
     reward.score = 10
 end
 
-function GetColliderAt(components, x, y)
-    for collider in components.colliders do
-        local position = components:GetEntityComponentOfType("position", collider.entityId)
-        if position and position.x == x and position.y == y then
-            return collider
-        end
-    end
-    return nil
-end
-
-function IsObstacleInTheWay(components, x, y, mask)
-    for collider in components.colliders do
-        local position = components:GetEntityComponentOfType("position", collider.entityId)
-        if position and (position.x == x) and (position.y == y) and (mask & collider.mask) ~= 0 then
-            return true
-        end
-    end
-    return false
-end
-
 function OnStrike(components, weapon, victimCollider, entitiesDestroyed)
-    local ownerInput = components:GetEntityComponentOfType("input", weapon.ownerId)
-    local ownerHero = components:GetEntityComponentOfType("hero", weapon.ownerId)
-    local health = components:GetEntityComponentOfType("health", victimCollider.entityId)
-    local reward = components:GetEntityComponentOfType("reward", victimCollider.entityId)
-    if health then
-        health.hp = health.hp - 1
-        if health.hp <= 0 then
-            entitiesDestroyed[#entitiesDestroyed + 1] = victimCollider.entityId
-            if ownerHero and reward then
-                ownerHero.score = ownerHero.score + reward.score
+    local ownerInput = components:GetEntityComponentOfType(T.input, weapon.ownerId)
+    local ownerHero = components:GetEntityComponentOfType(T.hero, weapon.ownerId)
+    if victimCollider then
+        local health = components:GetEntityComponentOfType(T.health, victimCollider.entityId)
+        local reward = components:GetEntityComponentOfType(T.reward, victimCollider.entityId)
+        if health then
+            health.hp = health.hp - 1
+            if health.hp <= 0 then
+                entitiesDestroyed[#entitiesDestroyed + 1] = victimCollider.entityId
+                if ownerHero and reward then
+                    ownerHero.score = ownerHero.score + reward.score
+                end
             end
         end
     end
@@ -61,29 +53,23 @@ end
 
 function Weapons(components, ws, tick)
     local entitiesDestroyed = {}
-    for weapon in components.weapons do
-        local position = components:GetEntityComponentOfType("position", weapon.entityId)
-        if position then
-            local tile = components:GetEntityComponentOfType("tile", weapon.entityId)
-            if tile then
-                tile.phase = ((tile.phase + 1) % 4)
-            end
-            local collider = GetColliderAt(components, position.x, position.y)
-            if collider then
+    for weapon, position in components:Each(T.weapon, T.position) do
+        local tile = components:GetEntityComponentOfType(T.tile, weapon.entityId)
+        if tile then
+            tile.phase = ((tile.phase + 1) % 4)
+        end
+        local collider = components:ColliderAt(position.x, position.y)
+        if collider or components:Blocked(position.x, position.y, ~0) then
+            OnStrike(components, weapon, collider, entitiesDestroyed)
+        else
+            local x = position.x + weapon.dx
+            local y = position.y + weapon.dy
+            collider = components:ColliderAt(x, y)
+            if collider or components:Blocked(x, y, ~0) then
                 OnStrike(components, weapon, collider, entitiesDestroyed)
             else
-                local x = position.x + weapon.dx
-                local y = position.y + weapon.dy
-                collider = GetColliderAt(components, x, y)
-                if collider then
-                    OnStrike(components, weapon, collider, entitiesDestroyed)
-                else
-                    position.x = x
-                    position.y = y
-                    if tile then
-                        tile.dirty = true
-                    end
-                end
+                position.x = x
+                position.y = y
             end
         end
     end
@@ -93,72 +79,62 @@ function Weapons(components, ws, tick)
 end
 
 function PlayerFiring(components, ws, tick)
-    for input in components.inputs do
-        local hero = components:GetEntityComponentOfType("hero", input.entityId)
-        local playerPosition = components:GetEntityComponentOfType("position", input.entityId)
-        if hero and playerPosition then
-            if input.usePotion and hero.potions > 0 then
-                hero.potions = hero.potions - 1
-                entitiesDestroyed = {}
-                for monster in components.monsters do
-                    local monsterPosition = components:GetEntityComponentOfType("position", monster.entityId)
-                    if monsterPosition then
-                        local dx = monsterPosition.x - playerPosition.x
-                        local dy = monsterPosition.y - playerPosition.y
-                        if math.sqrt((dx * dx) + (dy * dy)) <= 5 then
-                            entitiesDestroyed[#entitiesDestroyed + 1] = monster.entityId
-                            local reward = components:GetEntityComponentOfType("reward", monster.entityId)
-                            if reward then
-                                hero.score = hero.score + reward.score
-                            end
-                        end
-                    end
-                end
-                for i,entityId in ipairs(entitiesDestroyed) do
-                    components:KillEntity(entityId)
+    for input, hero, playerPosition in components:Query(T.input, T.hero, T.position) do
+        if input.usePotion and hero.potions > 0 then
+            hero.potions = hero.potions - 1
+            entitiesDestroyed = {}
+            local monsters = components:WithinRadius(T.monster, playerPosition.x, playerPosition.y, 5)
+            for i,monster in ipairs(monsters) do
+                entitiesDestroyed[#entitiesDestroyed + 1] = monster.entityId
+                local reward = components:GetEntityComponentOfType(T.reward, monster.entityId)
+                if reward then
+                    hero.score = hero.score + reward.score
                 end
             end
-            input.usePotion = false
-            if input.fire ~= "" and not input.weaponInFlight then
-                local dx = 0
-                local dy = 0
-                local fireDelegates = {
-                    ["a"] = function()
-                        dx = -1
-                    end,
-                    ["d"] = function()
-                        dx = 1
-                    end,
-                    ["w"] = function()
-                        dy = -1
-                    end,
-                    ["s"] = function()
-                        dy = 1
-                    end,
-                }
-                local fireDelegate = fireDelegates[input.fire]
-                if fireDelegate then
-                    fireDelegate()
-                end
-                input.fireThisTick = false
-                if input.fireReleased then
-                    input.fire = ""
-                end
-                local id = components:CreateEntity()
-                local weapon = components:CreateComponentOfType("weapon", id)
-                local weaponPosition = components:CreateComponentOfType("position", id)
-                local tile = components:CreateComponentOfType("tile", id)
-                weapon.dx = dx
-                weapon.dy = dy
-                tile.name = "axe"
-                tile.z = 2
-                tile.spinning = true
-                weaponPosition.x = playerPosition.x + dx
-                weaponPosition.y = playerPosition.y + dy
-                weapon.ownerId = input.entityId
-                input.weaponInFlight = true
+            for i,entityId in ipairs(entitiesDestroyed) do
+                components:KillEntity(entityId)
             end
         end
+        input.usePotion = false
+        if input.fire ~= "" and not input.weaponInFlight then
+            local dx = 0
+            local dy = 0
+            local fireDelegates = {
+                ["a"] = function()
+                    dx = -1
+                end,
+                ["d"] = function()
+                    dx = 1
+                end,
+                ["w"] = function()
+                    dy = -1
+                end,
+                ["s"] = function()
+                    dy = 1
+                end,
+            }
+            local fireDelegate = fireDelegates[input.fire]
+            if fireDelegate then
+                fireDelegate()
+            end
+            input.fireThisTick = false
+            if input.fireReleased then
+                input.fire = ""
+            end
+            local id = components:CreateEntity()
+            local weapon = components:CreateComponentOfType(T.weapon, id)
+            local weaponPosition = components:CreateComponentOfType(T.position, id)
+            local tile = components:CreateComponentOfType(T.tile, id)
+            weapon.dx = dx
+            weapon.dy = dy
+            tile.name = "axe"
+            tile.z = 2
+            tile.spinning = true
+            weaponPosition.x = playerPosition.x + dx
+            weaponPosition.y = playerPosition.y + dy
+            weapon.ownerId = input.entityId
+            input.weaponInFlight = true
+        end
     end
 end
 
@@ -167,28 +143,28 @@ function PlayerMovement(components, ws, tick)
         if input.moveCooldown > 0 then
             input.moveCooldown = input.moveCooldown - 1
         elseif input.fire == "" then
-            local position = components:GetEntityComponentOfType("position", input.entityId)
+            local position = components:GetEntityComponentOfType(T.position, input.entityId)
             if position then
-                local collider = components:GetEntityComponentOfType("collider", input.entityId)
+                local collider = components:GetEntityComponentOfType(T.collider, input.entityId)
                 local mask = collider and collider.mask or 0
                 local moveDelegates = {
                     ["j"] = function()
-                        if not IsObstacleInTheWay(components, position.x - 1, position.y, mask) then
+                        if not components:Blocked(position.x - 1, position.y, mask) then
                             position.x = position.x - 1
                         end
                     end,
                     ["l"] = function()
-                        if not IsObstacleInTheWay(components, position.x + 1, position.y, mask) then
+                        if not components:Blocked(position.x + 1, position.y, mask) then
                             position.x = position.x + 1
                         end
                     end,
                     ["i"] = function()
-                        if not IsObstacleInTheWay(components, position.x, position.y - 1, mask) then
+                        if not components:Blocked(position.x, position.y - 1, mask) then
                             position.y = position.y - 1
                         end
                     end,
                     ["k"] = function()
-                        if not IsObstacleInTheWay(components, position.x, position.y + 1, mask) then
+                        if not components:Blocked(position.x, position.y + 1, mask) then
                             position.y = position.y + 1
                         end
                     end,
@@ -201,10 +177,6 @@ function PlayerMovement(components, ws, tick)
                     if input.moveReleased then
                         input.move = ""
                     end
-                    local tile = components:GetEntityComponentOfType("tile", input.entityId)
-                    if tile then
-                        tile.dirty = true
-                    end
                 end
             end
         end
@@ -213,104 +185,89 @@ end
 
 function AI(components, ws, tick)
     if tick % 5 ~= 0 then return end
-    local heroes = components.heroes
-    if #heroes ~= 1 then return end
-    local hero = heroes[1]
-    local playerPosition = components:GetEntityComponentOfType("position", hero.entityId)
-    if not playerPosition then return end
-    local playerHealth = components:GetEntityComponentOfType("health", hero.entityId)
-    local colliders = components.colliders
     entitiesDestroyed = {}
-    local playerDestroyed = false
-    for monster in components.monsters do
-        local position = components:GetEntityComponentOfType("position", monster.entityId)
-        local tile = components:GetEntityComponentOfType("tile", monster.entityId)
-        if position then
-            local collider = components:GetEntityComponentOfType("collider", monster.entityId)
-            local mask = collider and collider.mask or 0
-            local dx = math.abs(position.x - playerPosition.x)
-            local dy = math.abs(position.y - playerPosition.y)
-            local mx = 0
-            local my = 0
-            if position.x < playerPosition.x then
-                mx = 1
-            elseif position.x > playerPosition.x then
-                mx = -1
+    local heroesDestroyed = {}
+    for monster, position in components:Each(T.monster, T.position) do
+        local hero, playerPosition = components:Nearest(T.hero, position.x, position.y)
+        if not hero then break end
+        local collider = components:GetEntityComponentOfType(T.collider, monster.entityId)
+        local mask = collider and collider.mask or 0
+        local dx = math.abs(position.x - playerPosition.x)
+        local dy = math.abs(position.y - playerPosition.y)
+        local mx = 0
+        local my = 0
+        if position.x < playerPosition.x then
+            mx = 1
+        elseif position.x > playerPosition.x then
+            mx = -1
+        end
+        if position.y < playerPosition.y then
+            my = 1
+        elseif position.y > playerPosition.y then
+            my = -1
+        end
+        if (
+            (
+                (position.x + mx == playerPosition.x)
+                and (position.y == playerPosition.y)
+            )
+            or (
+                (position.x == playerPosition.x)
+                and (position.y + my == playerPosition.y)
+            )
+        ) then
+            local playerHealth = components:GetEntityComponentOfType(T.health, hero.entityId)
+            if playerHealth and not heroesDestroyed[hero.entityId] then
+                playerHealth.hp = playerHealth.hp - 10
+                if playerHealth.hp <= 0 then
+                    playerHealth.hp = 0
+                    heroesDestroyed[hero.entityId] = true
+                end
             end
-            if position.y < playerPosition.y then
-                my = 1
-            elseif position.y > playerPosition.y then
-                my = -1
+            local monsterHealth = components:GetEntityComponentOfType(T.health, monster.entityId)
+            if monsterHealth then
+                monsterHealth.hp = 0
+                entitiesDestroyed[#entitiesDestroyed + 1] = monster.entityId
             end
+        else
             if (
-                (
-                    (position.x + mx == playerPosition.x)
-                    and (position.y == playerPosition.y)
+                (dx > dy)
+                and not components:Blocked(
+                    position.x + mx,
+                    position.y,
+                    mask
                 )
-                or (
-                    (position.x == playerPosition.x)
-                    and (position.y + my == playerPosition.y)
+            ) then
+                position.x = position.x + mx
+            elseif (
+                not components:Blocked(
+                    position.x,
+                    position.y + my,
+                    mask
                 )
             ) then
-                if playerHealth ~= nullptr and not playerDestroyed then
-                    playerHealth.hp = playerHealth.hp - 10
-                    if playerHealth.hp <= 0 then
-                        playerHealth.hp = 0
-                        playerDestroyed = true
-                    end
-                end
-                local monsterHealth = components:GetEntityComponentOfType("health", monster.entityId)
-                if monsterHealth then
-                    monsterHealth.hp = 0
-                    entitiesDestroyed[#entitiesDestroyed + 1] = monster.entityId
-                end
-            else
-                if (
-                    (dx > dy)
-                    and not IsObstacleInTheWay(
-                        components,
-                        position.x + mx,
-                        position.y,
-                        mask
-                    )
-                ) then
-                    position.x = position.x + mx
-                elseif (
-                    not IsObstacleInTheWay(
-                        components,
-                        position.x,
-                        position.y + my,
-                        mask
-                    )
-                ) then
-                    position.y = position.y + my
-                elseif (
-                    not IsObstacleInTheWay(
-                        components,
-                        position.x + mx,
-                        position.y,
-                        mask
-                    )
-                ) then
-                    position.x = position.x + mx
-                end
-                if tile then
-                    tile.dirty = true
-                end
+                position.y = position.y + my
+            elseif (
+                not components:Blocked(
+                    position.x + mx,
+                    position.y,
+                    mask
+                )
+            ) then
+                position.x = position.x + mx
             end
         end
     end
     for i,entityId in ipairs(entitiesDestroyed) do
         components:KillEntity(entityId)
     end
-    if playerDestroyed then
-        components:KillEntity(hero.entityId)
+    for entityId in pairs(heroesDestroyed) do
+        components:KillEntity(entityId)
     end
 end
 
 function Generation(components, ws, tick)
-    for generator in components.generators do
-        local position = components:GetEntityComponentOfType("position", generator.entityId)
+    for generator, position in components:Query(T.generator, T.position) do
         local roll = math.random()
         if roll < generator.spawnChance then
             local d = math.floor(math.random(0, 4) + 0.5)
@@ -321,7 +278,7 @@ function Generation(components, ws, tick)
             else
                 y = y + 2 * (d % 2) - 1
             end
-            if not IsObstacleInTheWay(components, x, y, ~0) then
+            if not components:Blocked(x, y, ~0) then
                 AddMonster(components, x, y)
             end
         end
@@ -332,16 +289,15 @@ function Pickup(components, ws, tick)
     local heroes = components.heroes
     if #heroes ~= 1 then return end
     local hero = heroes[1]
-    local playerPosition = components:GetEntityComponentOfType("position", hero.entityId)
-    local playerHealth = components:GetEntityComponentOfType("health", hero.entityId)
+    local playerPosition = components:GetEntityComponentOfType(T.position, hero.entityId)
+    local playerHealth = components:GetEntityComponentOfType(T.health, hero.entityId)
     if not playerPosition or not playerHealth then
         return
     end
     local entitiesDestroyed = {}
     local exited = false
-    for pickup in components.pickups do
-        local position = components:GetEntityComponentOfType("position", pickup.entityId)
-        if position and position.x == playerPosition.x and position.y == playerPosition.y then
+    for pickup, position in components:Each(T.pickup, T.position) do
+        if position.x == playerPosition.x and position.y == playerPosition.y then
             local destroyPickup = true
             if pickup.type == "Treasure" then
                 hero.score = hero.score + 100
@@ -362,21 +318,19 @@ function Pickup(components, ws, tick)
         components:KillEntity(entityId)
     end
     if exited then
-        local tile = components:GetEntityComponentOfType("tile", hero.entityId)
+        local tile = components:GetEntityComponentOfType(T.tile, hero.entityId)
         if tile then
             tile.destroyed = true
         end
-        components:DestroyEntityComponentOfType("position", hero.entityId)
+        components:DestroyEntityComponentOfType(T.position, hero.entityId)
     end
 end
 
 function Hunger(components, ws, tick)
     if tick % 10 ~= 0 then return end
     local entitiesStarved = {}
-    for hero in components.heroes do
-        local health = components:GetEntityComponentOfType("health", hero.entityId)
-        local position = components:GetEntityComponentOfType("position", hero.entityId)
-        if health and position and health.hp > 0 then
+    for hero, health in components:Query(T.hero, T.health, T.position) do
+        if health.hp > 0 then
             health.hp = health.hp - 1
             if health.hp <= 0 then
                 entitiesStarved[#entitiesStarved + 1] = hero.entityId
@@ -388,53 +342,14 @@ function Hunger(components, ws, tick)
     end
 end
 
-local previousRender = json(nil)
-function Render(components, ws, tick)
-    local message = json.Parse('{"type": "render"}')
-    local sprites = json.Parse('[]')
-    local entitiesDestroyed = {}
-    for tile in components.tiles do
-        local sprite = json.Parse('{"id": ' .. tile.entityId .. '}')
-        if tile.destroyed then
-            sprite.destroyed = true
-            entitiesDestroyed[#entitiesDestroyed + 1] = tile.entityId
-        else
-            if not tile.dirty then goto continue end
-            tile.dirty = false
-            local position = components:GetEntityComponentOfType("position", tile.entityId)
-            if not position then goto continue end
-            sprite.texture = tile.name
-            sprite.x = position.x
-            sprite.y = position.y
-            sprite.z = tile.z
-            sprite.phase = tile.phase
-            sprite.spinning = tile.spinning
-            local weapon = components:GetEntityComponentOfType("weapon", tile.entityId)
-            if weapon then
-                local motion = json.Parse('{}')
-                motion.dx = weapon.dx
-                motion.dy = weapon.dy
-                sprite.motion = motion
-            end
-        end
-        json.Add(sprites, sprite)
-        ::continue::
-    end
-    message.sprites = sprites
+function RenderFields(components, fields, tick)
     local heroes = components.heroes
     if #heroes == 1 then
         local hero = heroes[1]
-        local playerHealth = components:GetEntityComponentOfType("health", hero.entityId)
-        message.health = playerHealth.hp
-        message.score = hero.score
-        message.potions = hero.potions
-    end
-    if message ~= previousRender then
-        ws:SendText(message)
-        previousRender = message
-    end
-    for i,entityId in ipairs(entitiesDestroyed) do
-        components:DestroyEntityComponentOfType("tile", entityId)
+        local playerHealth = components:GetEntityComponentOfType(T.health, hero.entityId)
+        fields.health = playerHealth and playerHealth.hp or 0
+        fields.score = hero.score
+        fields.potions = hero.potions
     end
 end
 
@@ -445,11 +360,11 @@ systems = {
     AI,
     Generation,
     Pickup,
-    Hunger,
-    Render
+    Hunger
 }
 
 function update(components, ws, tick)
+    T = components.T
     for i,system in ipairs(systems) do
         system(components, ws, tick)
     end